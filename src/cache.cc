@@ -0,0 +1,251 @@
+#include "cache.hh"
+
+#include "hash.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <spdlog/spdlog.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    constexpr uint32_t blob_magic{ 0x42504c47 }; // "GLPB"
+    constexpr uint32_t blob_version{ 2 };
+
+    // Basis for the second hash of the source path, anything but fnv1a_init
+    constexpr uint64_t path_hash_init{ 0x84222325cbf29ce4ull };
+
+    // Pixel rows start right after the header
+    struct BlobHeader
+    {
+        uint32_t magic, version;
+        uint64_t key;
+        int32_t width, height;
+        uint64_t stride;
+        // The source path's length and a hash independent of key, so two paths whose keys
+        // collide don't load each other's pixels
+        uint64_t path_hash;
+        uint32_t path_size;
+        uint8_t reserved[20];
+    };
+    static_assert(sizeof(BlobHeader) == 64);
+}
+
+BlobCache::BlobCache(std::string directory, uint64_t max_size, int screen_w, int screen_h)
+    : m_Directory{ std::move(directory) },
+      m_MaxSize{ max_size },
+      m_ScreenWidth{ screen_w },
+      m_ScreenHeight{ screen_h }
+{
+    std::error_code ec;
+    fs::create_directories(m_Directory, ec);
+
+    if (ec)
+        spdlog::warn(
+            fmt::format("Failed to create cache directory {}: {}", m_Directory, ec.message()));
+}
+
+std::optional<uint64_t> BlobCache::get_key(const std::string& path) const
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return std::nullopt;
+
+    uint64_t key{ fnv1a(path) };
+    key = fnv1a_value(st.st_mtim.tv_sec, key);
+    key = fnv1a_value(st.st_mtim.tv_nsec, key);
+    key = fnv1a_value(st.st_size, key);
+    key = fnv1a_value(m_ScreenWidth, key);
+    key = fnv1a_value(m_ScreenHeight, key);
+
+    return key;
+}
+
+std::optional<Image> BlobCache::load(uint64_t key, const std::string& path) const
+{
+    auto blob_path{ get_blob_path(key) };
+    int fd{ open(blob_path.c_str(), O_RDONLY | O_CLOEXEC) };
+
+    if (fd < 0)
+        return std::nullopt;
+
+    struct stat st;
+    void* data{ MAP_FAILED };
+
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > sizeof(BlobHeader))
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return std::nullopt;
+
+    size_t size{ static_cast<size_t>(st.st_size) };
+    const auto* header{ static_cast<const BlobHeader*>(data) };
+
+    if (header->magic != blob_magic || header->version != blob_version || header->key != key ||
+        header->width <= 0 || header->height <= 0 ||
+        header->stride < static_cast<uint64_t>(header->width) * 3 ||
+        static_cast<uint64_t>(header->height) > (size - sizeof(BlobHeader)) / header->stride)
+    {
+        spdlog::warn(fmt::format("Discarding corrupt cache blob {}", blob_path));
+        munmap(data, size);
+        unlink(blob_path.c_str());
+        return std::nullopt;
+    }
+
+    if (header->path_size != path.size() || header->path_hash != fnv1a(path, path_hash_init))
+    {
+        // Left in place, storing this path's blob replaces it
+        spdlog::debug(fmt::format("Cache blob {} belongs to another file", blob_path));
+        munmap(data, size);
+        return std::nullopt;
+    }
+
+    // Bump the mtime, it is what eviction orders blobs by
+    utimensat(AT_FDCWD, blob_path.c_str(), nullptr, 0);
+
+    Image img;
+    img.path   = path;
+    img.width  = header->width;
+    img.height = header->height;
+    img.stride = header->stride;
+    img.pixels = Image::PixelPtr{ static_cast<unsigned char*>(data) + sizeof(BlobHeader),
+                                  [data, size](unsigned char*) { munmap(data, size); } };
+
+    return img;
+}
+
+void BlobCache::store(uint64_t key, const Image& img) const
+{
+    if (m_MaxSize == 0)
+        return;
+
+    BlobHeader header{};
+    header.magic   = blob_magic;
+    header.version = blob_version;
+    header.key     = key;
+    header.width   = img.width;
+    header.height  = img.height;
+    header.stride  = img.stride;
+
+    header.path_hash = fnv1a(img.path, path_hash_init);
+    header.path_size = static_cast<uint32_t>(img.path.size());
+
+    // Write to a temporary file first so other instances never see a partial blob
+    auto blob_path{ get_blob_path(key) };
+    auto tmp_path{ fmt::format("{}.{}.{}.tmp",
+                               blob_path,
+                               getpid(),
+                               std::hash<std::thread::id>{}(std::this_thread::get_id())) };
+    int fd{ open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) };
+
+    if (fd < 0)
+        return;
+
+    auto write_all = [fd](const void* data, size_t len) {
+        const auto* p{ static_cast<const char*>(data) };
+        while (len > 0)
+        {
+            ssize_t n{ write(fd, p, len) };
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    };
+
+    bool ok{ write_all(&header, sizeof(header)) &&
+             write_all(img.pixels.get(), img.stride * img.height) };
+    close(fd);
+
+    if (!ok || rename(tmp_path.c_str(), blob_path.c_str()) != 0)
+    {
+        spdlog::warn(fmt::format("Failed to write cache blob {}", blob_path));
+        unlink(tmp_path.c_str());
+        return;
+    }
+
+    evict();
+}
+
+std::string BlobCache::get_blob_path(uint64_t key) const
+{
+    return fmt::format("{}/{:016x}.blob", m_Directory, key);
+}
+
+void BlobCache::evict() const
+{
+    // Only one instance prunes at a time, the others skip it since the cap is soft anyway
+    auto lock_path{ m_Directory + "/lock" };
+    int lock_fd{ open(lock_path.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644) };
+
+    if (lock_fd < 0)
+        return;
+
+    if (flock(lock_fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        close(lock_fd);
+        return;
+    }
+
+    struct Blob
+    {
+        std::string path;
+        timespec mtime;
+        uint64_t size;
+    };
+    std::vector<Blob> blobs;
+    uint64_t total{ 0 };
+    std::error_code ec;
+
+    for (const auto& entry : fs::directory_iterator(m_Directory, ec))
+    {
+        struct stat st;
+        if (stat(entry.path().c_str(), &st) != 0)
+            continue;
+
+        // Leftovers of an instance that died while writing
+        if (entry.path().extension() == ".tmp" && time(nullptr) - st.st_mtim.tv_sec > 3600)
+            unlink(entry.path().c_str());
+
+        if (entry.path().extension() != ".blob")
+            continue;
+
+        blobs.push_back({ entry.path(), st.st_mtim, static_cast<uint64_t>(st.st_size) });
+        total += st.st_size;
+    }
+
+    if (total > m_MaxSize)
+    {
+        std::sort(blobs.begin(), blobs.end(), [](const Blob& a, const Blob& b) {
+            return a.mtime.tv_sec != b.mtime.tv_sec ? a.mtime.tv_sec < b.mtime.tv_sec
+                                                    : a.mtime.tv_nsec < b.mtime.tv_nsec;
+        });
+
+        // Blobs that are still mapped stay valid after they are unlinked
+        for (const auto& blob : blobs)
+        {
+            if (total <= m_MaxSize)
+                break;
+
+            if (unlink(blob.path.c_str()) == 0)
+                total -= blob.size;
+        }
+    }
+
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+}
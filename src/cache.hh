@@ -0,0 +1,33 @@
+#pragma once
+
+#include "image.hh"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// On-disk cache of decoded and resized wallpapers.
+// Each blob holds raw rows ready to be uploaded and is keyed by the source path, mtime, size
+// and the screen resolution it was scaled for. Blobs are written atomically and evicted in
+// least recently used order once the cache grows past its size limit, several glpaper
+// instances can share the same directory.
+class BlobCache
+{
+public:
+    BlobCache(std::string directory, uint64_t max_size, int screen_w, int screen_h);
+
+    // Returns the cache key for path, or nothing if the file can't be stat'd
+    std::optional<uint64_t> get_key(const std::string& path) const;
+
+    // Maps the blob for key into memory, pixels are unmapped once the image is freed
+    std::optional<Image> load(uint64_t key, const std::string& path) const;
+    void store(uint64_t key, const Image& img) const;
+
+private:
+    std::string get_blob_path(uint64_t key) const;
+    void evict() const;
+
+    std::string m_Directory;
+    uint64_t m_MaxSize;
+    int m_ScreenWidth, m_ScreenHeight;
+};
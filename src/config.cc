@@ -1,5 +1,6 @@
 #include "config.hh"
 
+#include <algorithm>
 #include <cxxopts/cxxopts.hh>
 #include <filesystem>
 namespace fs = std::filesystem;
@@ -37,12 +38,40 @@ Config::Config(cxxopts::ParseResult& res)
         }
     }
 
+    const char* xdg_cache_home{ getenv("XDG_CACHE_HOME") };
+    if (xdg_cache_home)
+    {
+        m_CachePath = std::string(xdg_cache_home) + "/glpaper";
+    }
+    else
+    {
+        const char* home{ getenv("HOME") };
+        m_CachePath = std::string(home ? home : "/tmp") + "/.cache/glpaper";
+    }
+
     if (res.count("directory"))
+        m_DirectoryPaths =
+            get_existing_directories(res["directory"].as<std::vector<std::string>>());
+
+    if (res.count("recursive"))
     {
-        auto path{ res["directory"].as<std::string>() };
+        m_Recursive    = res["recursive"].as<bool>();
+        m_RecursiveSet = true;
+    }
 
-        if (fs::exists(path))
-            m_DirectoryPath = std::move(path);
+    if (res.count("include"))
+        m_Include = res["include"].as<std::vector<std::string>>();
+
+    if (res.count("exclude"))
+        m_Exclude = res["exclude"].as<std::vector<std::string>>();
+
+    if (res.count("playlist"))
+        m_PlaylistPath = res["playlist"].as<std::string>();
+
+    if (res.count("order"))
+    {
+        set_order(res["order"].as<std::string>());
+        m_OrderSet = true;
     }
 
     if (res.count("bg-color"))
@@ -77,6 +106,24 @@ Config::Config(cxxopts::ParseResult& res)
         m_DisplayDurationSet = true;
     }
 
+    if (res.count("prefetch"))
+    {
+        m_PrefetchCount    = std::clamp(res["prefetch"].as<int>(), 1, 8);
+        m_PrefetchCountSet = true;
+    }
+
+    if (res.count("cache-size"))
+    {
+        m_CacheSize    = static_cast<uint64_t>(std::max(res["cache-size"].as<int>(), 0)) << 20;
+        m_CacheSizeSet = true;
+    }
+
+    if (res.count("idle-pixmap"))
+    {
+        m_IdlePixmap    = res["idle-pixmap"].as<bool>();
+        m_IdlePixmapSet = true;
+    }
+
     load_config();
 }
 
@@ -84,13 +131,26 @@ void Config::load_config(bool reload)
 {
     m_Config->readFile(m_ConfigPath.c_str());
 
-    if ((reload || m_DirectoryPath.empty()) && m_Config->exists("directory"))
-    {
-        std::string tmp;
-        m_Config->lookupValue("directory", tmp);
+    if ((reload || m_DirectoryPaths.empty()) && m_Config->exists("directory"))
+        m_DirectoryPaths = get_existing_directories(lookup_strings("directory"));
 
-        if (fs::exists(tmp))
-            m_DirectoryPath = std::move(tmp);
+    if ((reload || !m_RecursiveSet) && m_Config->exists("recursive"))
+        m_Config->lookupValue("recursive", m_Recursive);
+
+    if ((reload || m_Include.empty()) && m_Config->exists("include"))
+        m_Include = lookup_strings("include");
+
+    if ((reload || m_Exclude.empty()) && m_Config->exists("exclude"))
+        m_Exclude = lookup_strings("exclude");
+
+    if ((reload || m_PlaylistPath.empty()) && m_Config->exists("playlist"))
+        m_Config->lookupValue("playlist", m_PlaylistPath);
+
+    if ((reload || !m_OrderSet) && m_Config->exists("order"))
+    {
+        std::string order;
+        m_Config->lookupValue("order", order);
+        set_order(order);
     }
 
     if ((reload || !m_BGColorSet) && m_Config->exists("bg-color"))
@@ -139,8 +199,25 @@ void Config::load_config(bool reload)
             std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::minutes(dur));
     }
 
-    if (m_DirectoryPath.empty())
-        throw std::runtime_error("Wallpaper directory was not provided");
+    if ((reload || !m_PrefetchCountSet) && m_Config->exists("prefetch"))
+    {
+        int n;
+        m_Config->lookupValue("prefetch", n);
+        m_PrefetchCount = std::clamp(n, 1, 8);
+    }
+
+    if ((reload || !m_CacheSizeSet) && m_Config->exists("cache-size"))
+    {
+        int size;
+        m_Config->lookupValue("cache-size", size);
+        m_CacheSize = static_cast<uint64_t>(std::max(size, 0)) << 20;
+    }
+
+    if ((reload || !m_IdlePixmapSet) && m_Config->exists("idle-pixmap"))
+        m_Config->lookupValue("idle-pixmap", m_IdlePixmap);
+
+    if (m_DirectoryPaths.empty() && m_PlaylistPath.empty())
+        throw std::runtime_error("Wallpaper directory or playlist was not provided");
 
     if (m_Config->exists("current-path"))
     {
@@ -148,15 +225,58 @@ void Config::load_config(bool reload)
         m_Config->lookupValue("current-path", tmp);
 
         if (fs::exists(tmp))
-            m_CurrentTexturePath = std::move(tmp);
+            m_CurrentTexturePath = PathStore::get().add(tmp);
     }
 }
 
-void Config::set_current_texture_path(std::string path)
+std::vector<std::string> Config::lookup_strings(const char* name) const
 {
+    std::vector<std::string> values;
+    auto& setting{ m_Config->lookup(name) };
+
+    if (setting.isAggregate())
+    {
+        for (auto& v : setting)
+            values.emplace_back(v);
+    }
+    else
+    {
+        values.emplace_back(setting);
+    }
+
+    return values;
+}
+
+std::vector<std::string> Config::get_existing_directories(std::vector<std::string> paths)
+{
+    std::erase_if(paths, [](const std::string& path) {
+        if (fs::is_directory(path))
+            return false;
+
+        spdlog::warn(fmt::format("Ignoring wallpaper directory {}, it does not exist", path));
+        return true;
+    });
+
+    return paths;
+}
+
+void Config::set_order(const std::string& name)
+{
+    if (name == "random")
+        m_Order = Order::Random;
+    else if (name == "sequential")
+        m_Order = Order::Sequential;
+    else
+        spdlog::error(fmt::format("Invalid order {}, must be random or sequential", name));
+}
+
+void Config::set_current_texture_path(PathStore::Id path)
+{
+    m_CurrentTexturePath = path;
+
     if (!m_Config->exists("current-path"))
         m_Config->getRoot().add("current-path", libconfig::Setting::TypeString);
 
-    m_Config->getRoot()["current-path"] = path;
+    m_Config->getRoot()["current-path"] = PathStore::get().get_path(path);
     m_Config->writeFile(m_ConfigPath);
 }
@@ -2,11 +2,14 @@
 
 #include <array>
 #include <chrono>
+#include <cstdint>
 #include <libconfig.h++>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "path_store.hh"
+
 namespace cxxopts
 {
     class ParseResult;
@@ -15,13 +18,28 @@ namespace cxxopts
 class Config
 {
 public:
+    enum class Order
+    {
+        Random,
+        // Sorted by path, or in the order of the playlist
+        Sequential,
+    };
+
     Config(cxxopts::ParseResult& res);
     ~Config() = default;
 
     // If reload is true existing values are overwritten
     void load_config(bool reload = false);
 
-    std::string get_wallpaper_directory() const { return m_DirectoryPath; }
+    const std::vector<std::string>& get_wallpaper_directories() const { return m_DirectoryPaths; }
+    // Whether subdirectories of the wallpaper directories are scanned too
+    bool get_recursive() const { return m_Recursive; }
+    // Glob patterns for the file names to use and the file or directory names to skip
+    const std::vector<std::string>& get_include() const { return m_Include; }
+    const std::vector<std::string>& get_exclude() const { return m_Exclude; }
+    // File listing the wallpapers, used instead of the directories when set
+    const std::string& get_playlist() const { return m_PlaylistPath; }
+    Order get_order() const { return m_Order; }
 
     const std::array<float, 4>& get_bg_color() const { return m_BGColor; }
     const std::vector<std::string>& get_enabled_transitions() const { return m_EnabledTransitions; }
@@ -29,14 +47,41 @@ public:
     std::chrono::milliseconds get_transition_duration() const { return m_TransitionDuration; }
     std::chrono::milliseconds get_display_duration() const { return m_DisplayDuration; }
 
-    std::string get_current_texture_path() const { return m_CurrentTexturePath; }
-    void set_current_texture_path(std::string path);
+    // Number of upcoming wallpapers decoded ahead of time
+    int get_prefetch_count() const { return m_PrefetchCount; }
+
+    // $XDG_CACHE_HOME/glpaper, the size limit is in bytes and 0 disables the cache
+    const std::string& get_cache_directory() const { return m_CachePath; }
+    uint64_t get_cache_size() const { return m_CacheSize; }
+
+    // Whether the final frame is handed to the root window between transitions
+    bool get_idle_pixmap() const { return m_IdlePixmap; }
+
+    PathStore::Id get_current_texture_path() const { return m_CurrentTexturePath; }
+    void set_current_texture_path(PathStore::Id path);
+    // Takes the new id of the same path after the path store is compacted, the file is left
+    // alone
+    void remap_current_texture_path(PathStore::Id path) { m_CurrentTexturePath = path; }
 
 private:
+    // Reads a single string or a list of strings
+    std::vector<std::string> lookup_strings(const char* name) const;
+    static std::vector<std::string> get_existing_directories(std::vector<std::string> paths);
+    // Logs an error and keeps the current order if name isn't one
+    void set_order(const std::string& name);
+
     std::unique_ptr<libconfig::Config> m_Config;
-    bool m_BGColorSet{ false }, m_TransitionDurationSet{ false }, m_DisplayDurationSet{ false };
-    std::string m_DirectoryPath, m_ConfigPath, m_CurrentTexturePath;
+    bool m_BGColorSet{ false }, m_TransitionDurationSet{ false }, m_DisplayDurationSet{ false },
+        m_PrefetchCountSet{ false }, m_CacheSizeSet{ false }, m_IdlePixmapSet{ false },
+        m_RecursiveSet{ false }, m_OrderSet{ false };
+    std::string m_ConfigPath, m_CachePath, m_PlaylistPath;
+    PathStore::Id m_CurrentTexturePath{ PathStore::invalid_id };
+    std::vector<std::string> m_DirectoryPaths, m_Include, m_Exclude;
     std::array<float, 4> m_BGColor;
     std::vector<std::string> m_EnabledTransitions;
     std::chrono::milliseconds m_TransitionDuration, m_DisplayDuration;
+    int m_PrefetchCount{ 2 };
+    uint64_t m_CacheSize{ 512ull << 20 };
+    bool m_IdlePixmap{ false }, m_Recursive{ false };
+    Order m_Order{ Order::Random };
 };
@@ -0,0 +1,118 @@
+#include "cost_model.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <fmt/format.h>
+
+using namespace std::chrono;
+
+void CostModel::Average::add(Duration d)
+{
+    // Plain mean for the first few samples so one outlier doesn't stick around, then an
+    // exponential average that follows the storage getting slower or faster
+    ++samples;
+    value = samples <= 4 ? value + (d - value) / static_cast<int64_t>(samples)
+                         : (value * 3 + d) / 4;
+}
+
+void CostModel::record_decode(const std::string& path,
+                              uint64_t file_size,
+                              Duration decode,
+                              Duration resize)
+{
+    auto& cost{ m_Decode[{ get_format(path), get_size_class(file_size) }] };
+    cost.decode.add(decode);
+    cost.resize.add(resize);
+}
+
+void CostModel::record_upload(int width, int height, Duration upload)
+{
+    m_Upload[static_cast<int>(static_cast<int64_t>(width) * height / 1000000)].add(upload);
+}
+
+CostModel::Duration CostModel::estimate_decode(const std::string& path, uint64_t file_size) const
+{
+    auto format{ get_format(path) };
+    int size_class{ get_size_class(file_size) };
+
+    const DecodeCost* closest{ nullptr };
+    int closest_class{ 0 };
+
+    for (auto it{ m_Decode.lower_bound({ format, 0 }) };
+         it != m_Decode.end() && it->first.first == format;
+         ++it)
+    {
+        auto distance{ std::abs(it->first.second - size_class) };
+        if (!closest || distance < std::abs(closest_class - size_class))
+        {
+            closest       = &it->second;
+            closest_class = it->first.second;
+        }
+    }
+
+    if (!closest)
+        return default_decode;
+
+    auto total{ closest->decode.value + closest->resize.value };
+    // Decoding is roughly linear in the file size, size classes are powers of two
+    if (closest_class < size_class)
+        return total * (int64_t{ 1 } << std::min(size_class - closest_class, 16));
+    return total / (int64_t{ 1 } << std::min(closest_class - size_class, 16));
+}
+
+CostModel::Duration CostModel::estimate_upload(int width, int height) const
+{
+    if (m_Upload.empty())
+        return default_upload;
+
+    auto mpix{ static_cast<int>(static_cast<int64_t>(width) * height / 1000000) };
+    auto it{ m_Upload.lower_bound(mpix) };
+    if (it == m_Upload.end())
+        --it;
+
+    return it->second.value;
+}
+
+std::string CostModel::get_summary() const
+{
+    auto ms{ [](Duration d) { return duration_cast<duration<double, std::milli>>(d).count(); } };
+    std::string summary;
+
+    for (const auto& [key, cost] : m_Decode)
+    {
+        summary += fmt::format("{:<5} {:>7} KiB+: decode {:8.1f}ms, resize {:7.1f}ms ({} files)\n",
+                               key.first,
+                               (uint64_t{ 1 } << key.second) >> 10,
+                               ms(cost.decode.value),
+                               ms(cost.resize.value),
+                               cost.decode.samples);
+    }
+
+    for (const auto& [mpix, avg] : m_Upload)
+    {
+        summary += fmt::format(
+            "upload {:>3} MP: {:7.1f}ms ({} textures)\n", mpix, ms(avg.value), avg.samples);
+    }
+
+    return summary;
+}
+
+std::string CostModel::get_format(const std::string& path)
+{
+    auto dot{ path.find_last_of('.') };
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+        return "other";
+
+    std::string ext{ path.substr(dot + 1) };
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) {
+        return std::tolower(c);
+    });
+
+    return ext == "jpg" ? "jpeg" : ext;
+}
+
+int CostModel::get_size_class(uint64_t size)
+{
+    return std::max(static_cast<int>(std::bit_width(size)) - 1, 0);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+// Running averages of how long wallpapers take to load, so the next one can be scheduled to
+// be ready before it is needed. Decodes are bucketed by format and file size (powers of two),
+// uploads by pixel count. Only used from the render thread.
+class CostModel
+{
+public:
+    using Duration = std::chrono::steady_clock::duration;
+
+    void record_decode(const std::string& path,
+                       uint64_t file_size,
+                       Duration decode,
+                       Duration resize);
+    void record_upload(int width, int height, Duration upload);
+
+    // Predicted time to decode and scale a file, taken from the closest bucket of the same
+    // format, scaled by file size
+    Duration estimate_decode(const std::string& path, uint64_t file_size) const;
+    Duration estimate_upload(int width, int height) const;
+
+    // One line per bucket
+    std::string get_summary() const;
+
+private:
+    struct Average
+    {
+        Duration value{};
+        uint64_t samples{ 0 };
+
+        void add(Duration d);
+    };
+
+    struct DecodeCost
+    {
+        Average decode, resize;
+    };
+
+    // Used until something has been measured
+    static constexpr Duration default_decode{ std::chrono::milliseconds{ 500 } },
+        default_upload{ std::chrono::milliseconds{ 50 } };
+
+    static std::string get_format(const std::string& path);
+    static int get_size_class(uint64_t size);
+
+    // Keyed by format and size class
+    std::map<std::pair<std::string, int>, DecodeCost> m_Decode;
+    // Keyed by megapixels
+    std::map<int, Average> m_Upload;
+};
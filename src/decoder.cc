@@ -0,0 +1,344 @@
+#include "decoder.hh"
+
+#include "image_sniffer.hh"
+#include "pixel_pool.hh"
+#include "resize.hh"
+#include "strip_decoder.hh"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <spdlog/spdlog.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define STBI_MALLOC(size) PixelPool::get().allocate(size)
+#define STBI_REALLOC(p, size) PixelPool::get().reallocate(p, size)
+#define STBI_FREE(p) PixelPool::get().release(p)
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+
+namespace
+{
+    Image::PixelPtr get_pool_pixels(size_t size)
+    {
+        return { static_cast<unsigned char*>(PixelPool::get().allocate(size)),
+                 [](unsigned char* p) { PixelPool::get().release(p); } };
+    }
+
+    // The slot goes back to the ring when the image is freed without being uploaded
+    Image::PixelPtr get_slot_pixels(UploadRing* ring, const UploadRing::Slot& slot)
+    {
+        return { slot.data, [ring, index = slot.index](unsigned char*) { ring->release(index); } };
+    }
+
+    // A quarter of the physical memory
+    size_t get_memory_limit()
+    {
+        auto pages{ sysconf(_SC_PHYS_PAGES) }, page_size{ sysconf(_SC_PAGE_SIZE) };
+        if (pages <= 0 || page_size <= 0)
+            return SIZE_MAX;
+
+        return static_cast<size_t>(pages) * static_cast<size_t>(page_size) / 4;
+    }
+}
+
+Decoder::Decoder(unsigned int n_threads,
+                 int screen_w,
+                 int screen_h,
+                 std::unique_ptr<BlobCache> cache,
+                 UploadRing* upload_ring)
+    : m_ScreenWidth{ screen_w },
+      m_ScreenHeight{ screen_h },
+      m_ResizeThreads{ std::max(std::thread::hardware_concurrency() / std::max(n_threads, 1u),
+                                1u) },
+      m_Cache{ std::move(cache) },
+      m_UploadRing{ upload_ring },
+      m_MemoryLimit{ get_memory_limit() },
+      m_EventFd{ eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) }
+{
+    stbi_set_flip_vertically_on_load(true);
+
+    for (unsigned int i = 0; i < std::max(n_threads, 1u); ++i)
+        m_Threads.emplace_back(&Decoder::worker, this);
+}
+
+Decoder::~Decoder()
+{
+    {
+        std::lock_guard lock{ m_Mutex };
+        m_Stop = true;
+    }
+    m_CV.notify_all();
+
+    for (auto& t : m_Threads)
+        t.join();
+
+    if (m_EventFd >= 0)
+        close(m_EventFd);
+}
+
+bool Decoder::submit(std::string path)
+{
+    if (m_Pending >= max_pending)
+        return false;
+
+    {
+        std::lock_guard lock{ m_Mutex };
+        m_Jobs.push_back(std::move(path));
+    }
+    m_CV.notify_one();
+    ++m_Pending;
+
+    return true;
+}
+
+void Decoder::set_cache(std::unique_ptr<BlobCache> cache)
+{
+    std::lock_guard lock{ m_Mutex };
+    m_Cache = std::move(cache);
+}
+
+bool Decoder::poll(Image& out)
+{
+    if (m_Pending == 0 || !m_Results.pop(out))
+        return false;
+
+    --m_Pending;
+    return true;
+}
+
+void Decoder::clear_event() const
+{
+    uint64_t count;
+    if (m_EventFd >= 0)
+        while (read(m_EventFd, &count, sizeof(count)) > 0)
+            ;
+}
+
+void Decoder::worker()
+{
+    while (true)
+    {
+        std::string path;
+        std::shared_ptr<const BlobCache> cache;
+
+        {
+            std::unique_lock lock{ m_Mutex };
+            auto has_work{ [&]() { return m_Stop || !m_Jobs.empty(); } };
+
+            // Memory freed while decoding goes back to the kernel once nothing has been
+            // decoded for a while, trimming between the images of a burst would only make
+            // the next one fault all its pages in again
+            if (m_NeedsTrim && m_Busy == 0)
+            {
+                if (!m_CV.wait_until(lock, m_LastDone + trim_delay, has_work))
+                {
+                    // Another worker may have finished an image in the meantime
+                    if (m_Busy == 0 && std::chrono::steady_clock::now() >= m_LastDone + trim_delay)
+                    {
+                        m_NeedsTrim = false;
+                        lock.unlock();
+                        PixelPool::get().trim();
+                    }
+                    continue;
+                }
+            }
+            else
+                m_CV.wait(lock, has_work);
+
+            if (m_Stop)
+                return;
+
+            path = std::move(m_Jobs.front());
+            m_Jobs.pop_front();
+            cache = m_Cache;
+            ++m_Busy;
+        }
+
+        auto start{ std::chrono::steady_clock::now() };
+        auto img{ load(std::move(path), cache.get()) };
+        img.decode_time = std::chrono::steady_clock::now() - start;
+
+        // Can't fail, the number of jobs in flight is bounded by max_pending
+        m_Results.push(std::move(img));
+
+        if (m_EventFd >= 0)
+        {
+            uint64_t one{ 1 };
+            [[maybe_unused]] auto ret{ write(m_EventFd, &one, sizeof(one)) };
+        }
+
+        std::lock_guard lock{ m_Mutex };
+        --m_Busy;
+        m_NeedsTrim = true;
+        m_LastDone  = std::chrono::steady_clock::now();
+    }
+}
+
+Image Decoder::load(std::string path, const BlobCache* cache) const
+{
+    auto key{ cache ? cache->get_key(path) : std::nullopt };
+
+    if (key)
+    {
+        if (auto img{ cache->load(*key, path) })
+        {
+            img->from_cache = true;
+            stage(*img);
+            return std::move(*img);
+        }
+    }
+
+    Image img;
+    img.path = std::move(path);
+
+    std::error_code ec;
+    img.file_size = fs::file_size(img.path, ec);
+    if (ec)
+        img.file_size = 0;
+
+    // Huge images are scaled down while they are decoded instead of after
+    auto sniff{ sniff_file(img.path.c_str()) };
+    size_t size{ static_cast<size_t>(sniff.width) * static_cast<size_t>(sniff.height) * 3 };
+
+    if (size > min_streamed)
+    {
+        if (auto source{ StripDecoder::open(
+                img.path, sniff.format, m_ScreenWidth, m_ScreenHeight, m_MemoryLimit) })
+        {
+            if (load_strips(img, *source) && key)
+                cache->store(*key, img);
+
+            return img;
+        }
+
+        if (size > m_MemoryLimit)
+        {
+            spdlog::error(fmt::format("Image {} is too big to load, {}x{} takes {} MiB",
+                                      img.path,
+                                      sniff.width,
+                                      sniff.height,
+                                      size >> 20));
+            return img;
+        }
+    }
+
+    auto* pixel_data{ stbi_load(img.path.c_str(), &img.width, &img.height, nullptr, 3) };
+
+    if (!pixel_data)
+    {
+        spdlog::error(fmt::format("Failed to load image {}: {}", img.path, stbi_failure_reason()));
+        return img;
+    }
+
+    img.stride = static_cast<size_t>(img.width) * 3;
+    img.pixels = Image::PixelPtr{ pixel_data, stbi_image_free };
+
+    auto start{ std::chrono::steady_clock::now() };
+    resize(img);
+    img.resize_time = std::chrono::steady_clock::now() - start;
+
+    if (key)
+        cache->store(*key, img);
+
+    return img;
+}
+
+void Decoder::resize(Image& img) const
+{
+    auto [w, h]{ get_cover_size(img.width, img.height, m_ScreenWidth, m_ScreenHeight) };
+
+    if (w == img.width && h == img.height)
+    {
+        stage(img);
+        return;
+    }
+
+    auto stride{ get_aligned_stride(w) };
+    int upload_slot;
+    auto pixels{ get_pixels(stride * h, upload_slot) };
+
+    resize_cover(img.pixels.get(),
+                 img.width,
+                 img.height,
+                 img.stride,
+                 pixels.get(),
+                 w,
+                 h,
+                 stride,
+                 m_ResizeThreads);
+
+    img.width       = w;
+    img.height      = h;
+    img.stride      = stride;
+    img.pixels      = std::move(pixels);
+    img.upload_slot = upload_slot;
+}
+
+bool Decoder::load_strips(Image& img, StripDecoder& source) const
+{
+    int src_w{ source.get_width() }, src_h{ source.get_height() };
+    auto [w, h]{ get_cover_size(src_w, src_h, m_ScreenWidth, m_ScreenHeight) };
+    auto stride{ get_aligned_stride(w) };
+    int upload_slot;
+    auto pixels{ get_pixels(stride * h, upload_slot) };
+
+    size_t strip_stride{ static_cast<size_t>(src_w) * 3 };
+    auto strip{ get_pool_pixels(strip_stride * strip_rows) };
+    StripResizer resizer{ src_w, src_h, pixels.get(), w, h, stride, true };
+
+    // Rows below the crop are never decoded
+    while (!resizer.is_done())
+    {
+        int n{ source.read_rows(strip.get(), strip_stride, strip_rows) };
+        if (n == 0)
+        {
+            spdlog::error(fmt::format("Failed to load image {}: {}", img.path, source.get_error()));
+            return false;
+        }
+
+        auto start{ std::chrono::steady_clock::now() };
+        resizer.push(strip.get(), strip_stride, n);
+        img.resize_time += std::chrono::steady_clock::now() - start;
+    }
+
+    spdlog::debug(fmt::format(
+        "Decoded {} in strips of {}x{}, scaled to {}x{}", img.path, src_w, strip_rows, w, h));
+
+    img.width       = w;
+    img.height      = h;
+    img.stride      = stride;
+    img.pixels      = std::move(pixels);
+    img.upload_slot = upload_slot;
+
+    return true;
+}
+
+Image::PixelPtr Decoder::get_pixels(size_t size, int& upload_slot) const
+{
+    auto slot{ m_UploadRing ? m_UploadRing->acquire(size) : std::nullopt };
+    upload_slot = slot ? slot->index : -1;
+
+    // Resize straight into the mapped buffer so the upload needs no further copies
+    if (slot)
+        return get_slot_pixels(m_UploadRing, *slot);
+
+    return get_pool_pixels(size);
+}
+
+void Decoder::stage(Image& img) const
+{
+    size_t size{ img.stride * img.height };
+    auto slot{ m_UploadRing ? m_UploadRing->acquire(size) : std::nullopt };
+
+    if (!slot)
+        return;
+
+    std::memcpy(slot->data, img.pixels.get(), size);
+
+    img.pixels      = get_slot_pixels(m_UploadRing, *slot);
+    img.upload_slot = slot->index;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "cache.hh"
+#include "image.hh"
+#include "queue.hh"
+#include "upload.hh"
+
+class StripDecoder;
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pool of worker threads that decode images off the render thread.
+// Paths are submitted by the render thread, finished images are handed back through a
+// lock-free queue so polling never blocks the render loop.
+class Decoder
+{
+public:
+    // Maximum number of images that can be submitted but not yet polled
+    static constexpr size_t max_pending{ 16 };
+    // Images that decode to more bytes than this are decoded in strips when their format
+    // allows it
+    static constexpr size_t min_streamed{ 64 << 20 };
+    // Source rows decoded per strip
+    static constexpr int strip_rows{ 16 };
+    // How long the workers have to be idle before the pixel pool is trimmed
+    static constexpr std::chrono::seconds trim_delay{ 10 };
+
+    // Images are cover-fit to screen_w x screen_h before they are handed back. Pixels are
+    // written into a slot of upload_ring when one is free, upload_ring and cache can be null.
+    Decoder(unsigned int n_threads,
+            int screen_w,
+            int screen_h,
+            std::unique_ptr<BlobCache> cache,
+            UploadRing* upload_ring);
+    ~Decoder();
+
+    // Queues path for decoding, returns false if too many images are pending
+    bool submit(std::string path);
+    // Moves a finished image into out, failed decodes are returned with null pixels
+    bool poll(Image& out);
+
+    size_t get_pending() const { return m_Pending; }
+    // Replaces the cache, images that are being decoded finish with the old one
+    void set_cache(std::unique_ptr<BlobCache> cache);
+
+    // Becomes readable whenever a worker finishes an image, clear_event resets it and must be
+    // called before polling so no result is missed
+    int get_event_fd() const { return m_EventFd; }
+    void clear_event() const;
+
+private:
+    void worker();
+    // Scales img down to the screen size if it is bigger
+    void resize(Image& img) const;
+    // Decodes and scales source a strip at a time into img, only a strip of the full size image
+    // is ever in memory. Returns false if decoding failed.
+    bool load_strips(Image& img, StripDecoder& source) const;
+    // Memory for a scaled image, from the upload ring if a slot is free
+    Image::PixelPtr get_pixels(size_t size, int& upload_slot) const;
+    // Moves the pixels of img into an upload ring slot if one is free
+    void stage(Image& img) const;
+    Image load(std::string path, const BlobCache* cache) const;
+
+    std::vector<std::thread> m_Threads;
+    int m_ScreenWidth, m_ScreenHeight;
+    // Number of threads a single resize is split across
+    unsigned int m_ResizeThreads;
+    // Guarded by m_Mutex, each worker holds on to it while it decodes
+    std::shared_ptr<const BlobCache> m_Cache;
+    UploadRing* m_UploadRing;
+    // Images that would take more memory than this to decode whole are skipped
+    size_t m_MemoryLimit;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_CV;
+    std::deque<std::string> m_Jobs;
+    // Workers decoding an image
+    unsigned int m_Busy{ 0 };
+    // Something was decoded since the pixel pool was last trimmed, the last time a worker
+    // finished an image
+    bool m_NeedsTrim{ false };
+    std::chrono::steady_clock::time_point m_LastDone;
+    bool m_Stop{ false };
+
+    AtomicQueue<Image, max_pending> m_Results;
+    int m_EventFd;
+    // Only touched by the render thread
+    size_t m_Pending{ 0 };
+};
@@ -0,0 +1,51 @@
+#include "deletion_queue.hh"
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+DeletionQueue& DeletionQueue::get()
+{
+    static DeletionQueue queue;
+    return queue;
+}
+
+void DeletionQueue::collect()
+{
+    if (!m_Queued.empty())
+    {
+        m_Batches.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), std::move(m_Queued) });
+        m_Queued.clear();
+        // Fences are only polled, without a flush one may never signal if no swap follows
+        glFlush();
+    }
+
+    // Fences signal in order, stop at the first one that hasn't
+    while (!m_Batches.empty())
+    {
+        auto& batch{ m_Batches.front() };
+        GLenum res{ glClientWaitSync(batch.fence, 0, 0) };
+
+        if (res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED)
+            break;
+
+        glDeleteSync(batch.fence);
+
+        for (auto [kind, id] : batch.resources)
+        {
+            switch (kind)
+            {
+            case Kind::Texture:
+                glDeleteTextures(1, &id);
+                break;
+            case Kind::Program:
+                glDeleteProgram(id);
+                break;
+            case Kind::Buffer:
+                glDeleteBuffers(1, &id);
+                break;
+            }
+        }
+
+        m_Batches.pop_front();
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <deque>
+#include <utility>
+#include <vector>
+
+typedef struct __GLsync* GLsync;
+
+// Defers deleting GL objects until the GPU is done with every command issued before the
+// deletion was requested, so tearing down a resource never has to synchronize with the GPU.
+// Only used from the render thread.
+class DeletionQueue
+{
+public:
+    static DeletionQueue& get();
+
+    void delete_texture(unsigned int id) { m_Queued.emplace_back(Kind::Texture, id); }
+    void delete_program(unsigned int id) { m_Queued.emplace_back(Kind::Program, id); }
+    void delete_buffer(unsigned int id) { m_Queued.emplace_back(Kind::Buffer, id); }
+
+    // Fences the deletions queued since the last call and deletes the objects of batches
+    // whose fence has signaled, never waits
+    void collect();
+    // Whether collect() still has objects to delete
+    bool has_pending() const { return !m_Queued.empty() || !m_Batches.empty(); }
+
+private:
+    DeletionQueue() = default;
+
+    enum class Kind
+    {
+        Texture,
+        Program,
+        Buffer,
+    };
+    using Resource = std::pair<Kind, unsigned int>;
+
+    struct Batch
+    {
+        GLsync fence;
+        std::vector<Resource> resources;
+    };
+
+    std::vector<Resource> m_Queued;
+    std::deque<Batch> m_Batches;
+};
@@ -0,0 +1,207 @@
+#include "directory_watcher.hh"
+
+#include "event_loop.hh"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <spdlog/spdlog.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <unordered_set>
+
+using namespace std::chrono;
+
+DirectoryWatcher::DirectoryWatcher(EventLoop& loop, Callback callback)
+    : m_Loop{ loop },
+      m_Callback{ std::move(callback) }
+{
+    m_InotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_TimerFd   = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (m_InotifyFd < 0 || m_TimerFd < 0)
+    {
+        spdlog::warn(fmt::format("Failed to set up directory watching: {}", strerror(errno)));
+        return;
+    }
+
+    m_Loop.add(m_InotifyFd, EPOLLIN, [this](uint32_t) { read_events(); });
+    m_Loop.add(m_TimerFd, EPOLLIN, [this](uint32_t) {
+        uint64_t expirations;
+        while (read(m_TimerFd, &expirations, sizeof(expirations)) > 0)
+            ;
+        flush();
+    });
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+    if (m_InotifyFd >= 0)
+    {
+        m_Loop.remove(m_InotifyFd);
+        close(m_InotifyFd);
+    }
+
+    if (m_TimerFd >= 0)
+    {
+        m_Loop.remove(m_TimerFd);
+        close(m_TimerFd);
+    }
+}
+
+void DirectoryWatcher::watch(const std::vector<std::string>& directories, bool recursive)
+{
+    if (m_InotifyFd < 0)
+        return;
+
+    m_Recursive = recursive;
+
+    std::unordered_set<std::string_view> wanted{ directories.begin(), directories.end() };
+
+    for (auto it{ m_Watches.begin() }; it != m_Watches.end();)
+    {
+        if (wanted.contains(it->first))
+        {
+            ++it;
+            continue;
+        }
+
+        inotify_rm_watch(m_InotifyFd, it->second);
+        m_Directories.erase(it->second);
+        it = m_Watches.erase(it);
+    }
+
+    size_t n_failed{ 0 };
+    int error{ 0 };
+
+    for (const auto& dir : directories)
+    {
+        if (m_Watches.contains(dir))
+            continue;
+
+        // Files count as added once they have been written completely or moved in, new
+        // subdirectories are only seen through IN_CREATE
+        int wd{ inotify_add_watch(m_InotifyFd,
+                                  dir.c_str(),
+                                  IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE |
+                                      IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) };
+
+        if (wd < 0)
+        {
+            ++n_failed;
+            error = errno;
+            continue;
+        }
+
+        m_Watches.emplace(dir, wd);
+        m_Directories.emplace(wd, dir);
+    }
+
+    // Usually ENOSPC from running into fs.inotify.max_user_watches, so only warn once
+    if (n_failed > 0)
+        spdlog::warn(fmt::format("Failed to watch {} of {} directories: {}",
+                                 n_failed,
+                                 directories.size(),
+                                 strerror(error)));
+}
+
+void DirectoryWatcher::read_events()
+{
+    alignas(inotify_event) char buf[16384];
+    bool changed{ false };
+
+    while (true)
+    {
+        ssize_t len{ read(m_InotifyFd, buf, sizeof(buf)) };
+        if (len <= 0)
+            break;
+
+        for (char* p = buf; p < buf + len;)
+        {
+            const auto* ev{ reinterpret_cast<const inotify_event*>(p) };
+            p += sizeof(inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                m_Rescan = changed = true;
+                continue;
+            }
+
+            // Events of watches that were removed in the meantime
+            auto dir{ m_Directories.find(ev->wd) };
+            if (dir == m_Directories.end())
+                continue;
+
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+                m_Rescan = changed = true;
+                continue;
+            }
+
+            // Subdirectories aren't scanned unless recursive
+            if (ev->mask & IN_ISDIR)
+            {
+                if (m_Recursive)
+                    m_Rescan = changed = true;
+                continue;
+            }
+
+            if (ev->len == 0)
+                continue;
+
+            auto path{ fs::path{ dir->second } / ev->name };
+
+            // Newly created files are reported once they are closed. Symlinks and hard links
+            // are never opened for writing, so they are added right away.
+            if (ev->mask & IN_CREATE)
+            {
+                struct stat st;
+                if (lstat(path.c_str(), &st) != 0 || (!S_ISLNK(st.st_mode) && st.st_nlink < 2))
+                    continue;
+            }
+
+            m_Changes[path] = (ev->mask & (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO)) != 0;
+            changed = true;
+        }
+    }
+
+    if (!changed)
+        return;
+
+    auto now{ steady_clock::now() };
+    if (m_FirstChange == steady_clock::time_point{})
+        m_FirstChange = now;
+
+    // Pushed back by every event, but never past max_delay after the first one
+    auto due{ std::min(now + quiet_time, m_FirstChange + max_delay) };
+    auto ns{ duration_cast<nanoseconds>(std::max(due, now + nanoseconds{ 1 }).time_since_epoch()) };
+
+    itimerspec spec{};
+    spec.it_value.tv_sec  = ns.count() / 1000000000;
+    spec.it_value.tv_nsec = ns.count() % 1000000000;
+    timerfd_settime(m_TimerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void DirectoryWatcher::flush()
+{
+    Changes changes;
+    changes.rescan = m_Rescan;
+
+    if (!m_Rescan)
+    {
+        for (auto& [path, added] : m_Changes)
+            (added ? changes.added : changes.removed).push_back(path);
+    }
+
+    m_Changes.clear();
+    m_Rescan      = false;
+    m_FirstChange = {};
+
+    if (changes.rescan || !changes.added.empty() || !changes.removed.empty())
+        m_Callback(std::move(changes));
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class EventLoop;
+
+// Watches directories with inotify and reports files that were added or removed. Events are
+// coalesced until the directories have been quiet for a moment (or a burst has gone on for too
+// long), so a bulk copy is applied as one batch.
+class DirectoryWatcher
+{
+public:
+    struct Changes
+    {
+        std::vector<std::string> added, removed;
+        // Events were lost or a directory was created, moved or removed, everything has to be
+        // rescanned
+        bool rescan{ false };
+    };
+    using Callback = std::function<void(Changes changes)>;
+
+    DirectoryWatcher(EventLoop& loop, Callback callback);
+    ~DirectoryWatcher();
+
+    // Replaces the watched directories, ones that are already watched keep their watch.
+    // Subdirectories being created, moved or removed only cause a rescan when recursive.
+    void watch(const std::vector<std::string>& directories, bool recursive = false);
+
+private:
+    // Time without events before a batch is reported
+    static constexpr std::chrono::milliseconds quiet_time{ 300 };
+    // Longest a batch is held back during a continuous stream of events
+    static constexpr std::chrono::milliseconds max_delay{ 3000 };
+
+    void read_events();
+    void flush();
+
+    EventLoop& m_Loop;
+    Callback m_Callback;
+    int m_InotifyFd{ -1 }, m_TimerFd{ -1 };
+    // Watch descriptor per directory and the other way around
+    std::unordered_map<std::string, int> m_Watches;
+    std::unordered_map<int, std::string> m_Directories;
+
+    // Last event per file path, true if the file was added
+    std::map<std::string, bool> m_Changes;
+    bool m_Rescan{ false };
+    bool m_Recursive{ false };
+    std::chrono::steady_clock::time_point m_FirstChange;
+};
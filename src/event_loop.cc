@@ -0,0 +1,201 @@
+#include "event_loop.hh"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+EventLoop::EventLoop()
+{
+    m_EpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_EpollFd < 0)
+        throw std::runtime_error(fmt::format("Failed to create epoll fd: {}", strerror(errno)));
+
+    // steady_clock is CLOCK_MONOTONIC
+    m_TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_TimerFd < 0)
+        throw std::runtime_error(fmt::format("Failed to create timer fd: {}", strerror(errno)));
+
+    add(m_TimerFd, EPOLLIN, [this](uint32_t) {
+        uint64_t expirations;
+        while (read(m_TimerFd, &expirations, sizeof(expirations)) > 0)
+            ;
+    });
+}
+
+EventLoop::~EventLoop()
+{
+    if (m_TimerFd >= 0)
+        close(m_TimerFd);
+    if (m_EpollFd >= 0)
+        close(m_EpollFd);
+}
+
+void EventLoop::add(int fd, uint32_t events, Callback callback)
+{
+    epoll_event ev{};
+    ev.events  = events;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        spdlog::error(fmt::format("Failed to watch fd {}: {}", fd, strerror(errno)));
+        return;
+    }
+
+    m_Callbacks[fd] = std::move(callback);
+}
+
+void EventLoop::modify(int fd, uint32_t events)
+{
+    epoll_event ev{};
+    ev.events  = events;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(m_EpollFd, EPOLL_CTL_MOD, fd, &ev) < 0)
+        spdlog::error(fmt::format("Failed to modify watch on fd {}: {}", fd, strerror(errno)));
+}
+
+void EventLoop::remove(int fd)
+{
+    epoll_ctl(m_EpollFd, EPOLL_CTL_DEL, fd, nullptr);
+    m_Callbacks.erase(fd);
+}
+
+void EventLoop::add_dbus(DBusConnection* bus)
+{
+    if (!dbus_connection_set_watch_functions(
+            bus, &EventLoop::add_watch, &EventLoop::remove_watch, &EventLoop::toggle_watch, this,
+            nullptr))
+        throw std::runtime_error("Failed to set D-Bus watch functions");
+}
+
+void EventLoop::set_deadline(std::chrono::steady_clock::time_point deadline)
+{
+    using namespace std::chrono;
+    auto ns{ duration_cast<nanoseconds>(deadline.time_since_epoch()).count() };
+
+    itimerspec spec{};
+    // A zero value disarms the timer, a deadline in the past should fire right away instead
+    spec.it_value.tv_sec  = std::max<int64_t>(ns, 1) / 1000000000;
+    spec.it_value.tv_nsec = std::max<int64_t>(ns, 1) % 1000000000;
+
+    timerfd_settime(m_TimerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void EventLoop::clear_deadline()
+{
+    itimerspec spec{};
+    timerfd_settime(m_TimerFd, 0, &spec, nullptr);
+}
+
+void EventLoop::wait(int timeout_ms)
+{
+    std::array<epoll_event, 16> events;
+    int n{ epoll_wait(m_EpollFd, events.data(), events.size(), timeout_ms) };
+
+    if (n < 0 && errno != EINTR)
+        spdlog::error(fmt::format("epoll_wait failed: {}", strerror(errno)));
+
+    for (int i = 0; i < n; ++i)
+    {
+        auto it{ m_Callbacks.find(events[i].data.fd) };
+        if (it == m_Callbacks.end())
+            continue;
+
+        // The callback may add or remove fds, including its own
+        auto callback{ it->second };
+        callback(events[i].events);
+    }
+}
+
+dbus_bool_t EventLoop::add_watch(DBusWatch* watch, void* data)
+{
+    auto* loop{ static_cast<EventLoop*>(data) };
+    int fd{ dbus_watch_get_unix_fd(watch) };
+
+    loop->m_Watches[fd].push_back(watch);
+    loop->update_watches(fd);
+
+    return true;
+}
+
+void EventLoop::remove_watch(DBusWatch* watch, void* data)
+{
+    auto* loop{ static_cast<EventLoop*>(data) };
+    int fd{ dbus_watch_get_unix_fd(watch) };
+
+    auto& watches{ loop->m_Watches[fd] };
+    watches.erase(std::remove(watches.begin(), watches.end(), watch), watches.end());
+    loop->update_watches(fd);
+}
+
+void EventLoop::toggle_watch(DBusWatch* watch, void* data)
+{
+    static_cast<EventLoop*>(data)->update_watches(dbus_watch_get_unix_fd(watch));
+}
+
+void EventLoop::update_watches(int fd)
+{
+    // libdbus usually has separate read and write watches on the same socket, but epoll only
+    // takes each fd once
+    uint32_t events{ 0 };
+    for (auto* watch : m_Watches[fd])
+    {
+        if (!dbus_watch_get_enabled(watch))
+            continue;
+
+        auto flags{ dbus_watch_get_flags(watch) };
+        if (flags & DBUS_WATCH_READABLE)
+            events |= EPOLLIN;
+        if (flags & DBUS_WATCH_WRITABLE)
+            events |= EPOLLOUT;
+    }
+
+    bool registered{ m_Callbacks.contains(fd) };
+
+    if (m_Watches[fd].empty())
+    {
+        m_Watches.erase(fd);
+        if (registered)
+            remove(fd);
+    }
+    else if (registered)
+    {
+        modify(fd, events);
+    }
+    else
+    {
+        add(fd, events, [this, fd](uint32_t ready) {
+            unsigned int flags{ 0 };
+            if (ready & EPOLLIN)
+                flags |= DBUS_WATCH_READABLE;
+            if (ready & EPOLLOUT)
+                flags |= DBUS_WATCH_WRITABLE;
+            if (ready & EPOLLERR)
+                flags |= DBUS_WATCH_ERROR;
+            if (ready & EPOLLHUP)
+                flags |= DBUS_WATCH_HANGUP;
+
+            // Handling a watch can add or remove watches, skip the ones that are gone
+            auto watches{ m_Watches[fd] };
+            for (auto* watch : watches)
+            {
+                auto current{ m_Watches.find(fd) };
+                if (current == m_Watches.end() ||
+                    std::ranges::find(current->second, watch) == current->second.end() ||
+                    !dbus_watch_get_enabled(watch))
+                    continue;
+
+                auto mask{ dbus_watch_get_flags(watch) | DBUS_WATCH_ERROR | DBUS_WATCH_HANGUP };
+                dbus_watch_handle(watch, flags & mask);
+            }
+        });
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <dbus/dbus.h>
+#include <functional>
+#include <map>
+#include <vector>
+
+// Waits on file descriptors and a single deadline with epoll, so an idle daemon sleeps until
+// something actually happens instead of polling. Only used from the render thread.
+class EventLoop
+{
+public:
+    // Called with the ready epoll events of the fd
+    using Callback = std::function<void(uint32_t events)>;
+
+    EventLoop();
+    ~EventLoop();
+
+    void add(int fd, uint32_t events, Callback callback);
+    void modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Drives the connection's I/O from the loop through its watch functions, incoming
+    // messages are left in the connection's queue for dbus_connection_pop_message
+    void add_dbus(DBusConnection* bus);
+
+    // Wakes the loop up at deadline, replacing any earlier deadline
+    void set_deadline(std::chrono::steady_clock::time_point deadline);
+    // Disarms the deadline, only fds wake the loop up
+    void clear_deadline();
+
+    // Waits for events for at most timeout_ms (-1 waits until an event or the deadline) and
+    // runs the callbacks of the ready fds
+    void wait(int timeout_ms);
+
+private:
+    static dbus_bool_t add_watch(DBusWatch* watch, void* data);
+    static void remove_watch(DBusWatch* watch, void* data);
+    static void toggle_watch(DBusWatch* watch, void* data);
+    // Registers fd for the union of its enabled watches
+    void update_watches(int fd);
+
+    int m_EpollFd{ -1 }, m_TimerFd{ -1 };
+    std::map<int, Callback> m_Callbacks;
+    std::map<int, std::vector<DBusWatch*>> m_Watches;
+};
@@ -0,0 +1,465 @@
+#include "file_prober.hh"
+
+#include "work_stealing_pool.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <numeric>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+    // Files per task of the thread pool
+    constexpr size_t batch_size{ 64 };
+    // Most threads the pool blocks in system calls with
+    constexpr unsigned int max_threads{ 64 };
+
+    FileProber::Stat to_stat(const struct statx& stx)
+    {
+        return { S_ISREG(stx.stx_mode),
+                 stx.stx_mtime.tv_sec,
+                 stx.stx_mtime.tv_nsec,
+                 static_cast<uint64_t>(stx.stx_size) };
+    }
+
+    void prep(io_uring_sqe* sqe, uint8_t op, int fd, const void* addr, uint32_t len, uint64_t off)
+    {
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = op;
+        sqe->fd     = fd;
+        sqe->addr   = reinterpret_cast<uint64_t>(addr);
+        sqe->len    = len;
+        sqe->off    = off;
+    }
+}
+
+// Minimal io_uring without liburing, only what the prober needs
+class FileProber::Ring
+{
+public:
+    // Returns null if io_uring is unavailable (old kernel, seccomp, io_uring_disabled) or lacks
+    // one of the operations the prober uses
+    static std::unique_ptr<Ring> create(unsigned int entries)
+    {
+        io_uring_params params{};
+        int fd{ static_cast<int>(syscall(__NR_io_uring_setup, entries, &params)) };
+
+        if (fd < 0)
+        {
+            spdlog::debug(fmt::format("io_uring is unavailable: {}", strerror(errno)));
+            return nullptr;
+        }
+
+        std::unique_ptr<Ring> ring{ new Ring{ fd, params } };
+        if (!ring->map(params) || !ring->supports_ops())
+            return nullptr;
+
+        return ring;
+    }
+
+    ~Ring()
+    {
+        if (m_Sqes != MAP_FAILED)
+            munmap(m_Sqes, m_SqesSize);
+        if (m_CqPtr != MAP_FAILED && m_CqPtr != m_SqPtr)
+            munmap(m_CqPtr, m_CqSize);
+        if (m_SqPtr != MAP_FAILED)
+            munmap(m_SqPtr, m_SqSize);
+
+        close(m_Fd);
+    }
+
+    // Returns null if the submission queue is full
+    io_uring_sqe* get_sqe()
+    {
+        auto head{ std::atomic_ref{ *m_SqHead }.load(std::memory_order_acquire) };
+        if (m_SqTail - head >= m_SqEntries)
+            return nullptr;
+
+        auto index{ m_SqTail & *m_SqMask };
+        m_SqArray[index] = index;
+        ++m_SqTail;
+
+        return &m_Sqes[index];
+    }
+
+    // Submits the queued entries and waits for at least one completion
+    bool submit_and_wait()
+    {
+        std::atomic_ref{ *m_SqTailPtr }.store(m_SqTail, std::memory_order_release);
+
+        while (true)
+        {
+            auto to_submit{ m_SqTail - m_Submitted };
+            long ret{ syscall(
+                __NR_io_uring_enter, m_Fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0) };
+
+            if (ret >= 0)
+            {
+                m_Submitted += ret;
+                return true;
+            }
+
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                spdlog::warn(fmt::format("io_uring_enter failed: {}", strerror(errno)));
+                return false;
+            }
+        }
+    }
+
+    // Calls fn(user_data, res) for every completion
+    template<typename F>
+    void reap(F&& fn)
+    {
+        auto head{ *m_CqHead };
+        auto tail{ std::atomic_ref{ *m_CqTail }.load(std::memory_order_acquire) };
+
+        for (; head != tail; ++head)
+        {
+            const auto& cqe{ m_Cqes[head & *m_CqMask] };
+            fn(cqe.user_data, cqe.res);
+        }
+
+        std::atomic_ref{ *m_CqHead }.store(head, std::memory_order_release);
+    }
+
+private:
+    Ring(int fd, const io_uring_params& params)
+        : m_Fd{ fd },
+          m_SqEntries{ params.sq_entries }
+    {
+    }
+
+    bool map(const io_uring_params& p)
+    {
+        m_SqSize   = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        m_CqSize   = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        m_SqesSize = p.sq_entries * sizeof(io_uring_sqe);
+
+        // Both rings share one mapping since 5.4
+        bool single_mmap{ (p.features & IORING_FEAT_SINGLE_MMAP) != 0 };
+        if (single_mmap)
+            m_SqSize = m_CqSize = std::max(m_SqSize, m_CqSize);
+
+        m_SqPtr = mmap(nullptr,
+                       m_SqSize,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE,
+                       m_Fd,
+                       IORING_OFF_SQ_RING);
+        m_CqPtr = single_mmap ? m_SqPtr
+                              : mmap(nullptr,
+                                     m_CqSize,
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE,
+                                     m_Fd,
+                                     IORING_OFF_CQ_RING);
+        m_Sqes  = static_cast<io_uring_sqe*>(mmap(nullptr,
+                                                 m_SqesSize,
+                                                 PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_POPULATE,
+                                                 m_Fd,
+                                                 IORING_OFF_SQES));
+
+        if (m_SqPtr == MAP_FAILED || m_CqPtr == MAP_FAILED || m_Sqes == MAP_FAILED)
+        {
+            spdlog::warn(fmt::format("Failed to map the io_uring queues: {}", strerror(errno)));
+            return false;
+        }
+
+        auto* sq{ static_cast<char*>(m_SqPtr) };
+        auto* cq{ static_cast<char*>(m_CqPtr) };
+
+        m_SqHead    = reinterpret_cast<uint32_t*>(sq + p.sq_off.head);
+        m_SqTailPtr = reinterpret_cast<uint32_t*>(sq + p.sq_off.tail);
+        m_SqMask    = reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_mask);
+        m_SqArray   = reinterpret_cast<uint32_t*>(sq + p.sq_off.array);
+        m_CqHead    = reinterpret_cast<uint32_t*>(cq + p.cq_off.head);
+        m_CqTail    = reinterpret_cast<uint32_t*>(cq + p.cq_off.tail);
+        m_CqMask    = reinterpret_cast<uint32_t*>(cq + p.cq_off.ring_mask);
+        m_Cqes      = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+        m_SqTail = m_Submitted = *m_SqTailPtr;
+
+        return true;
+    }
+
+    bool supports_ops() const
+    {
+        constexpr int n_ops{ 256 };
+        std::unique_ptr<io_uring_probe, decltype(&free)> probe{
+            static_cast<io_uring_probe*>(
+                calloc(1, sizeof(io_uring_probe) + n_ops * sizeof(io_uring_probe_op))),
+            &free
+        };
+
+        if (syscall(__NR_io_uring_register, m_Fd, IORING_REGISTER_PROBE, probe.get(), n_ops) < 0)
+            return false;
+
+        for (int op : { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE })
+        {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            {
+                spdlog::debug(fmt::format("io_uring lacks operation {}", op));
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    int m_Fd;
+    uint32_t m_SqEntries;
+    size_t m_SqSize{ 0 }, m_CqSize{ 0 }, m_SqesSize{ 0 };
+    void *m_SqPtr{ MAP_FAILED }, *m_CqPtr{ MAP_FAILED };
+    io_uring_sqe* m_Sqes{ static_cast<io_uring_sqe*>(MAP_FAILED) };
+
+    uint32_t *m_SqHead, *m_SqTailPtr, *m_SqMask, *m_SqArray;
+    uint32_t *m_CqHead, *m_CqTail, *m_CqMask;
+    io_uring_cqe* m_Cqes;
+    // Tail of the entries that were queued and of the ones the kernel has been told about
+    uint32_t m_SqTail, m_Submitted;
+};
+
+FileProber::FileProber(unsigned int queue_depth, bool use_io_uring)
+    : m_QueueDepth{ std::max(queue_depth, 1u) }
+{
+    if (use_io_uring)
+        m_Ring = Ring::create(m_QueueDepth);
+
+    spdlog::debug(fmt::format("Probing files with {}, {} requests in flight",
+                              m_Ring ? "io_uring" : "a thread pool",
+                              m_Ring ? m_QueueDepth : std::min(m_QueueDepth, max_threads)));
+}
+
+FileProber::~FileProber() = default;
+
+std::vector<FileProber::Stat> FileProber::stat(std::span<const char* const> paths) const
+{
+    if (!m_Ring)
+        return stat_threaded(paths);
+
+    std::vector<Stat> results(paths.size());
+    std::vector<struct statx> buffers(m_QueueDepth);
+    // File each slot is working on
+    std::vector<size_t> slot_files(m_QueueDepth);
+    std::vector<uint32_t> free_slots(m_QueueDepth);
+    std::iota(free_slots.begin(), free_slots.end(), 0);
+
+    size_t next{ 0 }, in_flight{ 0 };
+
+    while (next < paths.size() || in_flight > 0)
+    {
+        for (; next < paths.size() && !free_slots.empty(); ++next, ++in_flight)
+        {
+            auto* sqe{ m_Ring->get_sqe() };
+            if (!sqe)
+                break;
+
+            auto slot{ free_slots.back() };
+            free_slots.pop_back();
+            slot_files[slot] = next;
+
+            prep(sqe,
+                 IORING_OP_STATX,
+                 AT_FDCWD,
+                 paths[next],
+                 STATX_TYPE | STATX_SIZE | STATX_MTIME,
+                 reinterpret_cast<uint64_t>(&buffers[slot]));
+            sqe->user_data = slot;
+        }
+
+        if (!m_Ring->submit_and_wait())
+        {
+            // Whatever was in flight is reported as missing
+            auto rest{ stat_threaded(paths.subspan(next)) };
+            std::copy(rest.begin(), rest.end(), results.begin() + next);
+            break;
+        }
+
+        m_Ring->reap([&](uint64_t slot, int res) {
+            if (res == 0)
+                results[slot_files[slot]] = to_stat(buffers[slot]);
+
+            free_slots.push_back(slot);
+            --in_flight;
+        });
+    }
+
+    return results;
+}
+
+void FileProber::read_headers(std::span<const char* const> paths,
+                              const HeaderCallback& callback) const
+{
+    if (!m_Ring)
+        return read_headers_threaded(paths, callback);
+
+    enum class Stage
+    {
+        Free,
+        Open,
+        Read,
+        Close,
+    };
+
+    struct Slot
+    {
+        size_t file;
+        Stage stage{ Stage::Free };
+        int fd;
+        // Result of the last request
+        int res;
+    };
+
+    std::vector<unsigned char> buffers(m_QueueDepth * header_size);
+    std::vector<Slot> slots(m_QueueDepth);
+    std::vector<uint32_t> free_slots(m_QueueDepth), completed;
+    std::iota(free_slots.begin(), free_slots.end(), 0);
+
+    auto queue{ [&](uint32_t index, Stage stage, uint8_t op, int fd, void* buf, uint32_t len) {
+        auto* sqe{ m_Ring->get_sqe() };
+        if (!sqe)
+            return false;
+
+        prep(sqe, op, fd, buf, len, 0);
+        sqe->user_data     = index;
+        slots[index].stage = stage;
+
+        if (stage == Stage::Open)
+        {
+            sqe->addr       = reinterpret_cast<uint64_t>(paths[slots[index].file]);
+            sqe->open_flags = O_RDONLY | O_CLOEXEC | O_NOCTTY;
+        }
+
+        return true;
+    } };
+
+    size_t next{ 0 }, in_flight{ 0 };
+
+    while (next < paths.size() || in_flight > 0)
+    {
+        // Slots whose next request doesn't fit in the submission queue are retried next round
+        std::erase_if(completed, [&](uint32_t index) {
+            auto& slot{ slots[index] };
+            auto* buf{ &buffers[index * header_size] };
+
+            if (slot.stage == Stage::Open && slot.res >= 0)
+            {
+                slot.fd = slot.res;
+                return queue(index, Stage::Read, IORING_OP_READ, slot.fd, buf, header_size);
+            }
+
+            if (slot.stage == Stage::Read)
+            {
+                if (!queue(index, Stage::Close, IORING_OP_CLOSE, slot.fd, nullptr, 0))
+                    return false;
+
+                callback(slot.file, buf, std::max(slot.res, 0));
+                return true;
+            }
+
+            if (slot.stage == Stage::Open)
+                callback(slot.file, nullptr, 0);
+
+            slot.stage = Stage::Free;
+            free_slots.push_back(index);
+            --in_flight;
+            return true;
+        });
+
+        for (; next < paths.size() && !free_slots.empty(); ++next, ++in_flight)
+        {
+            auto index{ free_slots.back() };
+            slots[index].file = next;
+
+            if (!queue(index, Stage::Open, IORING_OP_OPENAT, AT_FDCWD, nullptr, 0))
+                break;
+
+            free_slots.pop_back();
+        }
+
+        if (in_flight == 0)
+            break;
+
+        if (!m_Ring->submit_and_wait())
+        {
+            // Files in flight are reported as unreadable, this only happens if the ring itself
+            // broke
+            for (const auto& slot : slots)
+            {
+                if (slot.stage == Stage::Open || slot.stage == Stage::Read)
+                    callback(slot.file, nullptr, 0);
+            }
+
+            read_headers_threaded(paths.subspan(next),
+                                  [&](size_t i, const unsigned char* data, size_t len) {
+                                      callback(next + i, data, len);
+                                  });
+            break;
+        }
+
+        m_Ring->reap([&](uint64_t index, int res) {
+            slots[index].res = res;
+            completed.push_back(index);
+        });
+    }
+}
+
+std::vector<FileProber::Stat> FileProber::stat_threaded(std::span<const char* const> paths) const
+{
+    std::vector<Stat> results(paths.size());
+    WorkStealingPool pool{ std::min(m_QueueDepth, max_threads) };
+
+    for (size_t first = 0; first < paths.size(); first += batch_size)
+    {
+        pool.push([&, first] {
+            for (size_t i = first; i < std::min(first + batch_size, paths.size()); ++i)
+            {
+                struct statx stx;
+                if (statx(AT_FDCWD, paths[i], 0, STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx) == 0)
+                    results[i] = to_stat(stx);
+            }
+        });
+    }
+
+    pool.run();
+
+    return results;
+}
+
+void FileProber::read_headers_threaded(std::span<const char* const> paths,
+                                       const HeaderCallback& callback) const
+{
+    WorkStealingPool pool{ std::min(m_QueueDepth, max_threads) };
+
+    for (size_t first = 0; first < paths.size(); first += batch_size)
+    {
+        pool.push([&, first] {
+            std::vector<unsigned char> buf(header_size);
+
+            for (size_t i = first; i < std::min(first + batch_size, paths.size()); ++i)
+            {
+                int fd{ open(paths[i], O_RDONLY | O_CLOEXEC | O_NOCTTY) };
+                ssize_t len{ fd < 0 ? 0 : read(fd, buf.data(), buf.size()) };
+
+                if (fd >= 0)
+                    close(fd);
+
+                callback(i, buf.data(), std::max<ssize_t>(len, 0));
+            }
+        });
+    }
+
+    pool.run();
+}
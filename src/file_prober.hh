@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Stats files and reads their first bytes with many requests in flight, through io_uring when
+// the kernel allows it and a pool of threads otherwise. On network file systems every request
+// is a round trip, so doing them one after another is what makes scanning a big tree slow.
+class FileProber
+{
+public:
+    // Bytes read from the start of each file, one page is enough for the headers of all formats
+    // except JPEGs with big metadata segments
+    static constexpr size_t header_size{ 4096 };
+
+    struct Stat
+    {
+        // False if the file is gone or isn't a regular file
+        bool valid;
+        int64_t mtime_sec, mtime_nsec;
+        uint64_t size;
+    };
+
+    // Called with the position of the file in paths and its first bytes, len is 0 if it
+    // couldn't be read. With the thread pool it is called from several threads at once.
+    using HeaderCallback = std::function<void(size_t index, const unsigned char* data, size_t len)>;
+
+    // queue_depth is the number of requests kept in flight, use_io_uring false forces the
+    // thread pool
+    explicit FileProber(unsigned int queue_depth = 256, bool use_io_uring = true);
+    ~FileProber();
+
+    // Symlinks are followed
+    std::vector<Stat> stat(std::span<const char* const> paths) const;
+    void read_headers(std::span<const char* const> paths, const HeaderCallback& callback) const;
+
+    bool has_io_uring() const { return m_Ring != nullptr; }
+
+private:
+    class Ring;
+
+    std::vector<Stat> stat_threaded(std::span<const char* const> paths) const;
+    void read_headers_threaded(std::span<const char* const> paths,
+                               const HeaderCallback& callback) const;
+
+    unsigned int m_QueueDepth;
+    std::unique_ptr<Ring> m_Ring;
+};
@@ -0,0 +1,28 @@
+#include "glutil.hh"
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+bool gl_version_at_least(int major, int minor)
+{
+    GLint ctx_major{ 0 }, ctx_minor{ 0 };
+    glGetIntegerv(GL_MAJOR_VERSION, &ctx_major);
+    glGetIntegerv(GL_MINOR_VERSION, &ctx_minor);
+
+    return ctx_major > major || (ctx_major == major && ctx_minor >= minor);
+}
+
+bool gl_has_extension(std::string_view name)
+{
+    GLint n{ 0 };
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+
+    for (GLint i = 0; i < n; ++i)
+    {
+        const auto* ext{ reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)) };
+        if (ext && name == ext)
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string_view>
+
+// Whether the current context is at least version major.minor
+bool gl_version_at_least(int major, int minor);
+// Whether the current context advertises the extension name
+bool gl_has_extension(std::string_view name);
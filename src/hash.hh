@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// 64-bit FNV-1a, used to build cache keys
+constexpr uint64_t fnv1a_init{ 0xcbf29ce484222325ull };
+
+constexpr uint64_t fnv1a(const void* data, size_t len, uint64_t hash = fnv1a_init)
+{
+    const auto* bytes{ static_cast<const unsigned char*>(data) };
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+constexpr uint64_t fnv1a(std::string_view str, uint64_t hash = fnv1a_init)
+{
+    for (char c : str)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+template<typename T>
+constexpr uint64_t fnv1a_value(const T& value, uint64_t hash)
+{
+    return fnv1a(&value, sizeof(T), hash);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+// Decoded RGB pixel data waiting to be uploaded by the render thread
+struct Image
+{
+    using PixelPtr = std::unique_ptr<unsigned char, std::function<void(unsigned char*)>>;
+
+    std::string path;
+    int width{ 0 }, height{ 0 };
+    // Distance between rows in bytes, either tightly packed or padded to row_alignment
+    size_t stride{ 0 };
+    PixelPtr pixels;
+    // Slot of the UploadRing the pixels live in, -1 for ordinary memory
+    int upload_slot{ -1 };
+    // Time it took to produce the pixels, including reading and scaling
+    std::chrono::steady_clock::duration decode_time{}, resize_time{};
+    // Size of the file on disk
+    uint64_t file_size{ 0 };
+    // Whether the pixels came from the decoded image cache
+    bool from_cache{ false };
+};
@@ -0,0 +1,716 @@
+#include "image_sniffer.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    // Same as STBI_MAX_DIMENSIONS
+    constexpr int64_t max_dimension{ 1 << 24 };
+    // Most pages followed through the segments of a single JPEG
+    constexpr int max_jpeg_pages{ 64 };
+    // Most bytes read from the start of a file for the headers of other formats
+    constexpr size_t max_header_size{ 65536 };
+    // stb_image's STBI__MARKER_none
+    constexpr int marker_none{ 0xff };
+
+    enum class Sniff
+    {
+        NoMatch,
+        Match,
+        Truncated,
+    };
+
+    // Reads like stb_image's memory context, every byte past the end is 0 and skipping past
+    // the end is allowed. Whether the data ran out is remembered since the file may go on.
+    class Reader
+    {
+    public:
+        Reader(const unsigned char* data, size_t len)
+            : m_Data{ data },
+              m_Len{ len }
+        {
+        }
+
+        uint8_t u8()
+        {
+            if (m_Pos < m_Len)
+                return m_Data[m_Pos++];
+
+            m_Overrun = true;
+            return 0;
+        }
+
+        uint32_t be16()
+        {
+            uint32_t hi{ u8() };
+            return (hi << 8) | u8();
+        }
+
+        uint32_t be32()
+        {
+            uint32_t hi{ be16() };
+            return (hi << 16) | be16();
+        }
+
+        uint32_t le16()
+        {
+            uint32_t lo{ u8() };
+            return lo | (uint32_t{ u8() } << 8);
+        }
+
+        uint32_t le32()
+        {
+            uint32_t lo{ le16() };
+            return lo | (le16() << 16);
+        }
+
+        void skip(uint64_t n) { m_Pos += n; }
+
+        bool at_eof()
+        {
+            if (m_Pos < m_Len)
+                return false;
+
+            m_Overrun = true;
+            return true;
+        }
+
+        bool match(std::string_view magic)
+        {
+            return std::all_of(magic.begin(), magic.end(), [this](char c) {
+                return u8() == static_cast<uint8_t>(c);
+            });
+        }
+
+        uint64_t pos() const { return m_Pos; }
+        size_t size() const { return m_Len; }
+        bool overrun() const { return m_Overrun; }
+
+    private:
+        const unsigned char* m_Data;
+        size_t m_Len;
+        uint64_t m_Pos{ 0 };
+        bool m_Overrun{ false };
+    };
+
+    // Rejects what stb_image would refuse to load or what has no pixels
+    Sniff set_size(SniffResult& result, ImageFormat format, int64_t w, int64_t h)
+    {
+        if (w <= 0 || h <= 0 || w > max_dimension || h > max_dimension)
+            return Sniff::NoMatch;
+
+        result.format = format;
+        result.width  = static_cast<int>(w);
+        result.height = static_cast<int>(h);
+        return Sniff::Match;
+    }
+
+    int get_marker(Reader& r)
+    {
+        auto x{ r.u8() };
+        if (x != 0xff)
+            return marker_none;
+
+        // Repeated 0xff are fill bytes
+        while (x == 0xff)
+            x = r.u8();
+
+        return x;
+    }
+
+    bool is_sof(int m)
+    {
+        // Baseline, extended and progressive, the ones stb_image decodes
+        return m == 0xc0 || m == 0xc1 || m == 0xc2;
+    }
+
+    // Skips a segment without looking at the tables in it
+    bool skip_segment(Reader& r, int m)
+    {
+        // DRI
+        if (m == 0xdd)
+        {
+            if (r.be16() != 4)
+                return false;
+
+            r.skip(2);
+            return true;
+        }
+
+        // DQT, DHT, APPn and COM
+        if (m == 0xdb || m == 0xc4 || (m >= 0xe0 && m <= 0xef) || m == 0xfe)
+        {
+            auto len{ r.be16() };
+            if (len < 2)
+                return false;
+
+            r.skip(len - 2);
+            return true;
+        }
+
+        return false;
+    }
+
+    // Walks the segments up to the frame header. r is either at the start of the file or right
+    // after a segment, offset is where r's data starts in the file.
+    SniffResult walk_jpeg(Reader& r, uint64_t offset, bool at_start)
+    {
+        SniffResult result;
+        uint64_t segment{ r.pos() };
+
+        auto need_more{ [&](uint64_t pos) {
+            result.truncated     = true;
+            result.resume_offset = offset + pos;
+            return result;
+        } };
+
+        // Junk between segments is skipped, but not right after SOI
+        auto next_marker{ [&]() {
+            auto m{ get_marker(r) };
+            while (m == marker_none && !r.at_eof())
+                m = get_marker(r);
+            return m;
+        } };
+
+        int m;
+        if (at_start)
+        {
+            if (get_marker(r) != 0xd8)
+                return result;
+
+            segment = r.pos();
+            m       = get_marker(r);
+        }
+        else
+        {
+            m = next_marker();
+        }
+
+        while (!is_sof(m))
+        {
+            if (r.overrun())
+                return need_more(segment);
+            if (!skip_segment(r, m))
+                return r.overrun() ? need_more(segment) : result;
+
+            // The next segment starts past the data, continue there without reading the rest
+            if (r.pos() >= r.size())
+                return need_more(r.pos());
+
+            segment = r.pos();
+            m       = next_marker();
+        }
+
+        auto lf{ r.be16() };
+        auto precision{ r.u8() };
+        auto h{ r.be16() };
+        auto w{ r.be16() };
+        auto n_comp{ r.u8() };
+        bool ok{ lf >= 11 && precision == 8 && (n_comp == 1 || n_comp == 3 || n_comp == 4) &&
+                 lf == 8 + 3u * n_comp };
+
+        for (int i = 0; ok && i < n_comp; ++i)
+        {
+            r.u8(); // id
+            auto sampling{ r.u8() };
+            auto tq{ r.u8() };
+            ok = (sampling >> 4) >= 1 && (sampling >> 4) <= 4 && (sampling & 15) >= 1 &&
+                 (sampling & 15) <= 4 && tq <= 3;
+        }
+
+        if (r.overrun())
+            return need_more(segment);
+        if (ok)
+            set_size(result, ImageFormat::Jpeg, w, h);
+
+        return result;
+    }
+
+    constexpr uint32_t png_type(const char (&s)[5])
+    {
+        return (uint32_t(uint8_t(s[0])) << 24) | (uint32_t(uint8_t(s[1])) << 16) |
+               (uint32_t(uint8_t(s[2])) << 8) | uint32_t(uint8_t(s[3]));
+    }
+
+    Sniff sniff_png(Reader& r, SniffResult& result)
+    {
+        if (!r.match({ "\x89PNG\r\n\x1a\n", 8 }))
+            return Sniff::NoMatch;
+
+        bool first{ true }, paletted{ false };
+        uint32_t palette_len{ 0 };
+
+        while (true)
+        {
+            auto len{ r.be32() };
+            auto type{ r.be32() };
+
+            // Paletted images have a valid IHDR by now and only lack the check for a PLTE
+            // chunk, accept them rather than reading on
+            if (r.overrun())
+                return paletted ? Sniff::Match : Sniff::Truncated;
+
+            switch (type)
+            {
+            case png_type("CgBI"):
+                r.skip(len);
+                break;
+            case png_type("IHDR"):
+            {
+                if (!first || len != 13)
+                    return Sniff::NoMatch;
+                first = false;
+
+                int64_t w{ r.be32() }, h{ r.be32() };
+                auto depth{ r.u8() };
+                auto color{ r.u8() };
+                auto compression{ r.u8() };
+                auto filter{ r.u8() };
+                auto interlace{ r.u8() };
+
+                if (r.overrun())
+                    return Sniff::Truncated;
+                if ((depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16) ||
+                    color > 6 || (color == 3 && depth == 16) || (color != 3 && (color & 1)) ||
+                    compression || filter || interlace > 1 || w == 0 || h == 0 ||
+                    w > max_dimension || h > max_dimension)
+                    return Sniff::NoMatch;
+
+                paletted = color == 3;
+                auto n_comp{ paletted ? 4 : (color & 2 ? 3 : 1) + (color & 4 ? 1 : 0) };
+
+                if ((1 << 30) / w / n_comp < h ||
+                    set_size(result, ImageFormat::Png, w, h) != Sniff::Match)
+                    return Sniff::NoMatch;
+                if (!paletted)
+                    return Sniff::Match;
+                break;
+            }
+            case png_type("PLTE"):
+                if (first || len > 256 * 3 || len % 3 != 0)
+                    return Sniff::NoMatch;
+
+                palette_len = len / 3;
+                r.skip(len);
+                break;
+            case png_type("tRNS"):
+                return first ? Sniff::NoMatch : Sniff::Match;
+            case png_type("IDAT"):
+                return first || palette_len == 0 ? Sniff::NoMatch : Sniff::Match;
+            case png_type("IEND"):
+                return first ? Sniff::NoMatch : Sniff::Match;
+            default:
+                // Unknown critical chunks can't be skipped
+                if (first || !(type & (1 << 29)))
+                    return Sniff::NoMatch;
+
+                r.skip(len);
+                break;
+            }
+
+            r.be32(); // CRC
+        }
+    }
+
+    Sniff sniff_gif(Reader& r, SniffResult& result)
+    {
+        if (!r.match("GIF8"))
+            return Sniff::NoMatch;
+
+        auto version{ r.u8() };
+        if ((version != '7' && version != '9') || r.u8() != 'a')
+            return r.overrun() ? Sniff::Truncated : Sniff::NoMatch;
+
+        auto w{ r.le16() };
+        auto h{ r.le16() };
+
+        return r.overrun() ? Sniff::Truncated : set_size(result, ImageFormat::Gif, w, h);
+    }
+
+    Sniff sniff_bmp(Reader& r, SniffResult& result)
+    {
+        if (!r.match("BM"))
+            return Sniff::NoMatch;
+
+        r.skip(8); // file size and reserved
+        auto offset{ static_cast<int32_t>(r.le32()) };
+        auto header_size{ r.le32() };
+
+        if (offset < 0 || (header_size != 12 && header_size != 40 && header_size != 56 &&
+                           header_size != 108 && header_size != 124))
+            return r.overrun() ? Sniff::Truncated : Sniff::NoMatch;
+
+        int64_t w, h;
+        if (header_size == 12)
+        {
+            w = r.le16();
+            h = r.le16();
+        }
+        else
+        {
+            w = r.le32();
+            // Negative for top-down images
+            h = std::abs(int64_t{ static_cast<int32_t>(r.le32()) });
+        }
+
+        auto planes{ r.le16() };
+        auto bpp{ r.le16() };
+        bool ok{ planes == 1 };
+
+        if (ok && header_size != 12)
+        {
+            auto compression{ static_cast<int32_t>(r.le32()) };
+
+            // No RLE, JPEG or PNG, bitfields need 16 or 32 bits per pixel
+            ok = compression != 1 && compression != 2 && compression < 4 &&
+                 (compression != 3 || bpp == 16 || bpp == 32);
+            r.skip(20);
+
+            if (ok && (header_size == 40 || header_size == 56) && (bpp == 16 || bpp == 32))
+            {
+                if (header_size == 56)
+                    r.skip(16);
+
+                if (compression == 3)
+                {
+                    auto mr{ r.le32() };
+                    auto mg{ r.le32() };
+                    auto mb{ r.le32() };
+                    ok = mr != mg || mg != mb;
+                }
+                else
+                {
+                    ok = compression == 0;
+                }
+            }
+        }
+
+        if (r.overrun())
+            return Sniff::Truncated;
+
+        return ok ? set_size(result, ImageFormat::Bmp, w, h) : Sniff::NoMatch;
+    }
+
+    Sniff sniff_psd(Reader& r, SniffResult& result)
+    {
+        if (!r.match("8BPS"))
+            return Sniff::NoMatch;
+
+        auto version{ r.be16() };
+        r.skip(6);
+        auto channels{ r.be16() };
+        auto h{ static_cast<int32_t>(r.be32()) };
+        auto w{ static_cast<int32_t>(r.be32()) };
+        auto depth{ r.be16() };
+        // Only RGB
+        auto mode{ r.be16() };
+
+        if (r.overrun())
+            return Sniff::Truncated;
+        if (version != 1 || channels > 16 || (depth != 8 && depth != 16) || mode != 3)
+            return Sniff::NoMatch;
+
+        return set_size(result, ImageFormat::Psd, w, h);
+    }
+
+    Sniff sniff_pic(Reader& r, SniffResult& result)
+    {
+        if (!r.match("\x53\x80\xf6\x34"))
+            return Sniff::NoMatch;
+
+        r.skip(88);
+        int64_t w{ r.be16() }, h{ r.be16() };
+
+        if (r.at_eof())
+            return Sniff::Truncated;
+        if (w == 0 || (1 << 28) / w < h)
+            return Sniff::NoMatch;
+
+        r.skip(8);
+
+        // Up to 10 chained packets, each one has to be uncompressed, mixed or RLE
+        for (int n_packets = 0;; ++n_packets)
+        {
+            if (n_packets == 10)
+                return Sniff::NoMatch;
+
+            auto chained{ r.u8() };
+            auto size{ r.u8() };
+            r.skip(2); // type and channel
+
+            if (r.at_eof())
+                return Sniff::Truncated;
+            if (size != 8)
+                return Sniff::NoMatch;
+            if (!chained)
+                break;
+        }
+
+        return set_size(result, ImageFormat::Pic, w, h);
+    }
+
+    Sniff sniff_pnm(Reader& r, SniffResult& result)
+    {
+        if (r.u8() != 'P')
+            return Sniff::NoMatch;
+
+        auto t{ r.u8() };
+        if (t != '5' && t != '6')
+            return Sniff::NoMatch;
+
+        auto is_space{ [](char c) {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+        } };
+
+        char c{ static_cast<char>(r.u8()) };
+
+        // Whitespace and comments
+        auto skip_space{ [&]() {
+            while (true)
+            {
+                while (!r.at_eof() && is_space(c))
+                    c = static_cast<char>(r.u8());
+
+                if (r.at_eof() || c != '#')
+                    break;
+
+                while (!r.at_eof() && c != '\n' && c != '\r')
+                    c = static_cast<char>(r.u8());
+            }
+        } };
+
+        auto get_integer{ [&]() {
+            int64_t value{ 0 };
+            while (!r.at_eof() && c >= '0' && c <= '9')
+            {
+                value = std::min(value * 10 + (c - '0'), int64_t{ 1 } << 32);
+                c     = static_cast<char>(r.u8());
+            }
+            return value;
+        } };
+
+        skip_space();
+        auto w{ get_integer() };
+        skip_space();
+        auto h{ get_integer() };
+        skip_space();
+        auto max_value{ get_integer() };
+
+        if (r.overrun())
+            return Sniff::Truncated;
+        if (max_value > 65535)
+            return Sniff::NoMatch;
+
+        return set_size(result, ImageFormat::Pnm, w, h);
+    }
+
+    Sniff sniff_hdr(Reader& r, const unsigned char* data, size_t len, SniffResult& result)
+    {
+        if (!r.match("#?RADIANCE\n"))
+        {
+            r = Reader{ data, len };
+            if (!r.match("#?RGBE\n"))
+                return Sniff::NoMatch;
+        }
+
+        r = Reader{ data, len };
+
+        // One line, at most 1023 characters of it are kept
+        auto get_token{ [&]() {
+            std::string token;
+            char c{ static_cast<char>(r.u8()) };
+
+            while (!r.at_eof() && c != '\n')
+            {
+                token.push_back(c);
+                if (token.size() == 1023)
+                {
+                    while (!r.at_eof() && r.u8() != '\n')
+                        ;
+                    break;
+                }
+                c = static_cast<char>(r.u8());
+            }
+
+            return token;
+        } };
+
+        bool valid{ false };
+        while (true)
+        {
+            auto token{ get_token() };
+            if (token.c_str()[0] == '\0')
+                break;
+            if (strcmp(token.c_str(), "FORMAT=32-bit_rle_rgbe") == 0)
+                valid = true;
+        }
+
+        auto token{ get_token() };
+        if (r.overrun())
+            return Sniff::Truncated;
+
+        const char* p{ token.c_str() };
+        if (!valid || strncmp(p, "-Y ", 3) != 0)
+            return Sniff::NoMatch;
+
+        char* end;
+        auto h{ strtol(p + 3, &end, 10) };
+        while (*end == ' ')
+            ++end;
+
+        if (strncmp(end, "+X ", 3) != 0)
+            return Sniff::NoMatch;
+
+        auto w{ strtol(end + 3, nullptr, 10) };
+
+        return set_size(result, ImageFormat::Hdr, w, h);
+    }
+
+    // TGA has no magic, this is tried last like stb_image does
+    Sniff sniff_tga(Reader& r, SniffResult& result)
+    {
+        r.u8(); // ID length
+        auto colormap_type{ r.u8() };
+        auto image_type{ r.u8() };
+        int colormap_bpp{ 0 };
+
+        if (colormap_type > 1)
+            return Sniff::NoMatch;
+
+        if (colormap_type == 1)
+        {
+            if (image_type != 1 && image_type != 9)
+                return Sniff::NoMatch;
+
+            r.skip(4);
+            colormap_bpp = r.u8();
+            if (colormap_bpp != 8 && colormap_bpp != 15 && colormap_bpp != 16 &&
+                colormap_bpp != 24 && colormap_bpp != 32)
+                return Sniff::NoMatch;
+
+            r.skip(4);
+        }
+        else
+        {
+            // RGB or grey, RLE or not
+            if (image_type != 2 && image_type != 3 && image_type != 10 && image_type != 11)
+                return Sniff::NoMatch;
+
+            r.skip(9);
+        }
+
+        auto w{ r.le16() };
+        auto h{ r.le16() };
+        auto bpp{ r.u8() };
+        r.u8(); // alpha bits
+
+        if (r.overrun())
+            return Sniff::Truncated;
+
+        bool grey{ image_type == 3 || image_type == 11 };
+        bool ok{ colormap_bpp != 0 ? bpp == 8 || bpp == 16
+                                   : bpp == 8 || bpp == 15 || bpp == 16 || bpp == 24 ||
+                                         bpp == 32 || (bpp == 16 && grey) };
+
+        return ok ? set_size(result, ImageFormat::Tga, w, h) : Sniff::NoMatch;
+    }
+}
+
+SniffResult sniff_image(const unsigned char* data, size_t len)
+{
+    SniffResult result;
+
+    {
+        Reader r{ data, len };
+        result = walk_jpeg(r, 0, true);
+        if (result.format != ImageFormat::Unsupported || result.truncated)
+            return result;
+    }
+
+    // stb_image can't decode WebP, no need to try it as anything else
+    if (len >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0)
+        return result;
+
+    using SniffFn = Sniff (*)(Reader&, SniffResult&);
+    for (SniffFn fn : { sniff_png, sniff_gif, sniff_bmp, sniff_psd, sniff_pic, sniff_pnm })
+    {
+        Reader r{ data, len };
+        auto sniff{ fn(r, result) };
+
+        if (sniff == Sniff::Match)
+            return result;
+        if (sniff == Sniff::Truncated)
+        {
+            result.format    = ImageFormat::Unsupported;
+            result.truncated = true;
+            return result;
+        }
+
+        result = {};
+    }
+
+    for (int i = 0; i < 2; ++i)
+    {
+        Reader r{ data, len };
+        auto sniff{ i == 0 ? sniff_hdr(r, data, len, result) : sniff_tga(r, result) };
+
+        if (sniff == Sniff::Match)
+            return result;
+
+        result           = {};
+        result.truncated = sniff == Sniff::Truncated;
+        if (result.truncated)
+            return result;
+    }
+
+    return result;
+}
+
+SniffResult sniff_jpeg(const unsigned char* data, size_t len, uint64_t offset)
+{
+    Reader r{ data, len };
+    return walk_jpeg(r, offset, false);
+}
+
+SniffResult sniff_file(const char* path)
+{
+    int fd{ open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY) };
+    if (fd < 0)
+        return {};
+
+    std::vector<unsigned char> buf(sniff_size);
+    auto len{ std::max<ssize_t>(pread(fd, buf.data(), buf.size(), 0), 0) };
+    auto result{ sniff_image(buf.data(), len) };
+
+    // Only JPEGs resume somewhere past the start, everything else needs a bigger first read
+    while (result.truncated && result.resume_offset == 0 &&
+           static_cast<size_t>(len) == buf.size() && buf.size() < max_header_size)
+    {
+        buf.resize(buf.size() * 2);
+        len    = std::max<ssize_t>(pread(fd, buf.data(), buf.size(), 0), 0);
+        result = sniff_image(buf.data(), len);
+    }
+
+    for (int i = 0; i < max_jpeg_pages && result.truncated && result.resume_offset > 0; ++i)
+    {
+        auto offset{ result.resume_offset };
+        len = pread(fd, buf.data(), sniff_size, offset);
+
+        if (len <= 0)
+            break;
+
+        result = sniff_jpeg(buf.data(), len, offset);
+    }
+
+    close(fd);
+
+    // Whatever is still truncated ended early or had too much in front of its header
+    return result.truncated ? SniffResult{} : result;
+}
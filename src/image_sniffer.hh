@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum class ImageFormat : uint8_t
+{
+    // Not an image stb_image can read
+    Unsupported,
+    Jpeg,
+    Png,
+    Bmp,
+    Gif,
+    Psd,
+    Hdr,
+    Pic,
+    Pnm,
+    Tga,
+};
+
+// Bytes sniffing normally needs, one page
+constexpr size_t sniff_size{ 4096 };
+
+struct SniffResult
+{
+    ImageFormat format{ ImageFormat::Unsupported };
+    int width{ 0 }, height{ 0 };
+    // The data ended before the header did. JPEG segments are skipped without reading them, so
+    // a JPEG continues at resume_offset of the file, other formats need more of the file.
+    bool truncated{ false };
+    uint64_t resume_offset{ 0 };
+};
+
+// Finds the format and dimensions of an image from the start of its file, accepting the same
+// formats as stbi_info without trying every decoder in turn. Images without pixels or bigger
+// than stb_image will load are rejected.
+SniffResult sniff_image(const unsigned char* data, size_t len);
+// Continues sniffing a truncated JPEG, data starts at resume_offset
+SniffResult sniff_jpeg(const unsigned char* data, size_t len, uint64_t offset);
+// Sniffs a file reading one page at a time, only JPEGs with a lot of metadata or headers with
+// long comments need more than one
+SniffResult sniff_file(const char* path);
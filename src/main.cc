@@ -2,6 +2,7 @@
 #include "transitions.hh"
 #include "window.hh"
 
+#include <X11/Xlib.h>
 #include <cxxopts/cxxopts.hh>
 #include <dbus/dbus.h>
 #include <spdlog/spdlog.h>
@@ -50,6 +51,9 @@ void check_print_help(cxxopts::Options& opts) { }
 
 int main(int argc, char** argv)
 {
+    // Transitions may be compiled on a second GL context from another thread
+    XInitThreads();
+
     bool is_primary{ create_dbus_connection() };
     cxxopts::Options opts{ "glpaper", "X11 wallpaper setter using OpenGL" };
 
@@ -65,11 +69,19 @@ int main(int argc, char** argv)
         // clang-format off
         opts.add_options("Settings")
             ("b,bg-color", "RGBA values for the background color (0.0-1.0 ranges)", cxxopts::value<std::vector<float>>())
+            ("cache-size", "Size limit of the decoded wallpaper cache in MiB, 0 disables it", cxxopts::value<int>())
             ("c,config", "Path to the config file ($XDG_CONFIG_HOME/glpaper.conf is the default)", cxxopts::value<std::string>())
             ("d,duration", "Transition duration in milliseconds", cxxopts::value<int>())
+            ("exclude", "Glob patterns of file and directory names to skip", cxxopts::value<std::vector<std::string>>())
+            ("idle-pixmap", "Set the final frame as the root window pixmap and release GPU resources between transitions")
+            ("include", "Glob patterns of file names to use (all files by default)", cxxopts::value<std::vector<std::string>>())
+            ("l,playlist", "File listing wallpapers one per line or NUL separated, used instead of the directories", cxxopts::value<std::string>())
             ("m,minutes", "Number of minutes between wallpaper changes", cxxopts::value<int>())
+            ("o,order", "Order wallpapers are shown in, random (default) or sequential", cxxopts::value<std::string>())
+            ("p,prefetch", "Number of upcoming wallpapers to decode ahead of time (1-8)", cxxopts::value<int>())
+            ("R,recursive", "Scan subdirectories of the wallpaper directories")
             ("t,transitions", "A list of transition names, available transitions:" + transition_list, cxxopts::value<std::vector<std::string>>())
-            ("w,directory", "Wallpaper directory containing image files", cxxopts::value<std::string>())
+            ("w,directory", "Wallpaper directories containing image files", cxxopts::value<std::vector<std::string>>())
         ;
         // clang-format on
     }
@@ -79,6 +91,7 @@ int main(int argc, char** argv)
         opts.add_options("Action")
             ("n,next", "Next wallpaper")
             ("r,reload", "Reload configuration")
+            ("s,stats", "Print measured load times and missed deadlines")
         ;
         // clang-format on
     }
@@ -120,6 +133,35 @@ int main(int argc, char** argv)
             dbus_message_unref(msg);
         }
 
+        if (result.count("stats"))
+        {
+            DBusMessage* msg{ dbus_message_new_method_call("com.github.ahodesuka.glpaper.primary",
+                                                           "/com/github/ahodesuka/glpaper/stats",
+                                                           "com.github.ahodesuka.glpaper.stats",
+                                                           "get_stats") };
+            DBusError err;
+            dbus_error_init(&err);
+
+            DBusMessage* reply{ dbus_connection_send_with_reply_and_block(
+                bus, msg, DBUS_TIMEOUT_USE_DEFAULT, &err) };
+            dbus_message_unref(msg);
+
+            const char* stats{ nullptr };
+            if (reply &&
+                dbus_message_get_args(reply, &err, DBUS_TYPE_STRING, &stats, DBUS_TYPE_INVALID))
+                std::cout << stats;
+
+            if (reply)
+                dbus_message_unref(reply);
+
+            if (dbus_error_is_set(&err))
+            {
+                spdlog::error(fmt::format("D-Bus error: {}", err.message));
+                dbus_error_free(&err);
+                return EXIT_FAILURE;
+            }
+        }
+
         return EXIT_SUCCESS;
     }
     else
@@ -0,0 +1,169 @@
+#include "path_store.hh"
+
+#include "hash.hh"
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+    // Splits after the last slash, the directory keeps it
+    std::pair<std::string_view, std::string_view> split(std::string_view path)
+    {
+        auto pos{ path.rfind('/') };
+        if (pos == std::string_view::npos)
+            return { {}, path };
+
+        return { path.substr(0, pos + 1), path.substr(pos + 1) };
+    }
+
+    uint64_t hash_file(uint32_t directory, std::string_view name)
+    {
+        return fnv1a(name, fnv1a_value(directory, fnv1a_init));
+    }
+
+    // Doubles an index and puts the first n ids back in, hash returns the hash of an id
+    template<typename Fn>
+    void rebuild(std::vector<uint32_t>& index, size_t n, Fn&& hash)
+    {
+        index.assign(std::max<size_t>(index.size() * 2, 16), PathStore::invalid_id);
+        auto mask{ index.size() - 1 };
+
+        for (uint32_t id = 0; id < n; ++id)
+        {
+            auto slot{ hash(id) & mask };
+            while (index[slot] != PathStore::invalid_id)
+                slot = (slot + 1) & mask;
+
+            index[slot] = id;
+        }
+    }
+}
+
+PathStore& PathStore::get()
+{
+    static PathStore store;
+    return store;
+}
+
+PathStore::Id PathStore::add(std::string_view path)
+{
+    if (path.empty())
+        return invalid_id;
+
+    if ((m_Directories.size() + 1) * 2 > m_DirectoryIndex.size())
+    {
+        rebuild(m_DirectoryIndex, m_Directories.size(), [this](uint32_t id) {
+            return fnv1a(view(m_Directories[id]));
+        });
+    }
+
+    if ((m_Files.size() + 1) * 2 > m_FileIndex.size())
+    {
+        rebuild(m_FileIndex, m_Files.size(), [this](uint32_t id) {
+            return hash_file(m_Files[id].directory, view(m_Files[id].name));
+        });
+    }
+
+    auto [directory, name]{ split(path) };
+
+    auto& dir{ m_DirectoryIndex[find_directory_slot(directory)] };
+    if (dir == invalid_id)
+    {
+        dir = m_Directories.size();
+        m_Directories.push_back(append(directory));
+    }
+
+    auto& file{ m_FileIndex[find_file_slot(dir, name)] };
+    if (file == invalid_id)
+    {
+        file = m_Files.size();
+        m_Files.push_back({ dir, append(name) });
+    }
+
+    return file;
+}
+
+PathStore::Id PathStore::find(std::string_view path) const
+{
+    if (path.empty() || m_Files.empty())
+        return invalid_id;
+
+    auto [directory, name]{ split(path) };
+    auto dir{ m_DirectoryIndex[find_directory_slot(directory)] };
+
+    return dir == invalid_id ? invalid_id : m_FileIndex[find_file_slot(dir, name)];
+}
+
+std::string PathStore::get_path(Id id) const
+{
+    if (id >= m_Files.size())
+        return {};
+
+    const auto& file{ m_Files[id] };
+    auto directory{ view(m_Directories[file.directory]) };
+    auto name{ view(file.name) };
+
+    std::string path;
+    path.reserve(directory.size() + name.size());
+    path.append(directory).append(name);
+    return path;
+}
+
+std::vector<PathStore::Id> PathStore::compact(std::span<const Id> live)
+{
+    PathStore compacted;
+    std::vector<Id> ids(m_Files.size(), invalid_id);
+
+    for (auto id : live)
+    {
+        if (id < m_Files.size() && ids[id] == invalid_id)
+            ids[id] = compacted.add(get_path(id));
+    }
+
+    *this = std::move(compacted);
+    return ids;
+}
+
+size_t PathStore::get_memory_usage() const
+{
+    return m_Arena.capacity() + m_Directories.capacity() * sizeof(Span) +
+           m_Files.capacity() * sizeof(File) +
+           (m_DirectoryIndex.capacity() + m_FileIndex.capacity()) * sizeof(uint32_t);
+}
+
+PathStore::Span PathStore::append(std::string_view str)
+{
+    Span span{ static_cast<uint32_t>(m_Arena.size()), static_cast<uint32_t>(str.size()) };
+    m_Arena.insert(m_Arena.end(), str.begin(), str.end());
+    return span;
+}
+
+size_t PathStore::find_directory_slot(std::string_view directory) const
+{
+    auto mask{ m_DirectoryIndex.size() - 1 };
+    auto slot{ fnv1a(directory) & mask };
+
+    while (m_DirectoryIndex[slot] != invalid_id &&
+           view(m_Directories[m_DirectoryIndex[slot]]) != directory)
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+size_t PathStore::find_file_slot(uint32_t directory, std::string_view name) const
+{
+    auto mask{ m_FileIndex.size() - 1 };
+    auto slot{ hash_file(directory, name) & mask };
+
+    while (m_FileIndex[slot] != invalid_id)
+    {
+        const auto& file{ m_Files[m_FileIndex[slot]] };
+        if (file.directory == directory && view(file.name) == name)
+            break;
+
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
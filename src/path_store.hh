@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Interns wallpaper paths as a directory and a file name.
+// The characters of every directory and file name are kept in one arena and each path is
+// addressed by a 32-bit id, so a large library doesn't need a heap allocation per path and
+// picking a random one touches a few bytes. Ids stay valid until the store is compacted,
+// adding a path again returns the same id. Only used from the main thread.
+class PathStore
+{
+public:
+    using Id = uint32_t;
+    static constexpr Id invalid_id{ UINT32_MAX };
+
+    static PathStore& get();
+
+    // An empty path is not stored, invalid_id is returned for it
+    Id add(std::string_view path);
+    // Returns invalid_id if path was never added
+    Id find(std::string_view path) const;
+    // Empty for invalid_id
+    std::string get_path(Id id) const;
+
+    // Drops every path but the live ones and frees the space they took. Every id changes,
+    // the returned table maps the ids from before to the new ones, dropped ones to invalid_id.
+    std::vector<Id> compact(std::span<const Id> live);
+
+    size_t size() const { return m_Files.size(); }
+    // Bytes used by the arena, the tables and the hash indexes
+    size_t get_memory_usage() const;
+
+private:
+    PathStore() = default;
+
+    struct Span
+    {
+        uint32_t offset, length;
+    };
+
+    struct File
+    {
+        uint32_t directory;
+        Span name;
+    };
+
+    std::string_view view(Span span) const { return { m_Arena.data() + span.offset, span.length }; }
+    Span append(std::string_view str);
+
+    // Slot in the index holding the directory or file, or the empty slot it would go in
+    size_t find_directory_slot(std::string_view directory) const;
+    size_t find_file_slot(uint32_t directory, std::string_view name) const;
+
+    std::vector<char> m_Arena;
+    std::vector<Span> m_Directories;
+    std::vector<File> m_Files;
+    // Open addressing tables of ids into m_Directories and m_Files, invalid_id marks an empty
+    // slot. Sized to a power of two and kept at most half full.
+    std::vector<uint32_t> m_DirectoryIndex, m_FileIndex;
+};
@@ -0,0 +1,251 @@
+#include "pixel_pool.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+    // In front of every allocation, 16 bytes keep the alignment malloc gives
+    struct alignas(16) Header
+    {
+        // Size of the mapping, 0 if the allocation came from malloc
+        size_t capacity;
+        size_t size;
+    };
+    static_assert(sizeof(Header) == 16);
+
+    Header* get_header(void* p)
+    {
+        return static_cast<Header*>(p) - 1;
+    }
+
+    // Size classes are a quarter of a power of two apart, so at most 25% is wasted
+    size_t get_capacity(size_t size)
+    {
+        auto step{ std::max<size_t>(std::bit_floor(size) / 4, 4096) };
+        return (size + step - 1) / step * step;
+    }
+
+    // Reads the value of a "Name:   123 kB" line of /proc/self/status
+    uint64_t read_status_kb(const char* name)
+    {
+        FILE* f{ fopen("/proc/self/status", "re") };
+        if (!f)
+            return 0;
+
+        char line[256];
+        uint64_t kb{ 0 };
+        auto len{ strlen(name) };
+
+        while (fgets(line, sizeof(line), f))
+        {
+            if (strncmp(line, name, len) == 0 && line[len] == ':')
+            {
+                kb = strtoull(line + len + 1, nullptr, 10);
+                break;
+            }
+        }
+
+        fclose(f);
+        return kb;
+    }
+}
+
+PixelPool& PixelPool::get()
+{
+    static PixelPool pool;
+    return pool;
+}
+
+void* PixelPool::allocate(size_t size)
+{
+    if (size + sizeof(Header) < min_mapped)
+    {
+        auto* header{ static_cast<Header*>(malloc(sizeof(Header) + size)) };
+        if (!header)
+            return nullptr;
+
+        *header = { 0, size };
+        return header + 1;
+    }
+
+    auto capacity{ get_capacity(size + sizeof(Header)) };
+    void* base{ nullptr };
+
+    {
+        std::lock_guard lock{ m_Mutex };
+        // A somewhat bigger buffer does too, rather than mapping more
+        auto it{ m_Free.lower_bound(capacity) };
+
+        if (it != m_Free.end() && it->first <= capacity * 2)
+        {
+            capacity = it->first;
+            base     = it->second.back().base;
+            it->second.pop_back();
+            if (it->second.empty())
+                m_Free.erase(it);
+
+            m_FreeBytes -= capacity;
+            m_Used += capacity;
+        }
+    }
+
+    if (!base && !(base = map(capacity)))
+        return nullptr;
+
+    auto* header{ static_cast<Header*>(base) };
+    *header = { capacity, size };
+    return header + 1;
+}
+
+void* PixelPool::reallocate(void* p, size_t size)
+{
+    if (!p)
+        return allocate(size);
+
+    auto* header{ get_header(p) };
+
+    if (header->capacity == 0 && size + sizeof(Header) < min_mapped)
+    {
+        header = static_cast<Header*>(realloc(header, sizeof(Header) + size));
+        if (!header)
+            return nullptr;
+
+        header->size = size;
+        return header + 1;
+    }
+
+    if (header->capacity >= size + sizeof(Header))
+    {
+        header->size = size;
+        return p;
+    }
+
+    if (header->capacity > 0)
+    {
+        // Grows in place or moves the pages without copying them
+        auto capacity{ get_capacity(size + sizeof(Header)) };
+        void* base{ mremap(header, header->capacity, capacity, MREMAP_MAYMOVE) };
+        if (base == MAP_FAILED)
+            return nullptr;
+
+        {
+            std::lock_guard lock{ m_Mutex };
+            m_Used += capacity - static_cast<Header*>(base)->capacity;
+        }
+
+        header  = static_cast<Header*>(base);
+        *header = { capacity, size };
+        return header + 1;
+    }
+
+    // Outgrew malloc
+    auto* q{ allocate(size) };
+    if (!q)
+        return nullptr;
+
+    std::memcpy(q, p, header->size);
+    free(header);
+    return q;
+}
+
+void PixelPool::release(void* p)
+{
+    if (!p)
+        return;
+
+    auto* header{ get_header(p) };
+
+    if (header->capacity == 0)
+        free(header);
+    else
+        recycle(header, header->capacity);
+}
+
+void PixelPool::trim()
+{
+    {
+        std::lock_guard lock{ m_Mutex };
+
+        for (auto& [capacity, buffers] : m_Free)
+        {
+            for (auto& b : buffers)
+            {
+                if (b.dirty)
+                    madvise(b.base, capacity, MADV_DONTNEED);
+                b.dirty = false;
+            }
+        }
+    }
+
+    // stb_image's small allocations and everything else on the heap
+    malloc_trim(0);
+
+    auto resident{ get_resident_memory() };
+    std::lock_guard lock{ m_Mutex };
+    m_IdleResident = resident;
+}
+
+size_t PixelPool::get_used() const
+{
+    std::lock_guard lock{ m_Mutex };
+    return m_Used;
+}
+
+size_t PixelPool::get_free() const
+{
+    std::lock_guard lock{ m_Mutex };
+    return m_FreeBytes;
+}
+
+uint64_t PixelPool::get_idle_resident() const
+{
+    std::lock_guard lock{ m_Mutex };
+    return m_IdleResident;
+}
+
+void* PixelPool::map(size_t capacity)
+{
+    void* base{
+        mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+    };
+    if (base == MAP_FAILED)
+        return nullptr;
+
+    std::lock_guard lock{ m_Mutex };
+    m_Used += capacity;
+    return base;
+}
+
+void PixelPool::recycle(void* base, size_t capacity)
+{
+    {
+        std::lock_guard lock{ m_Mutex };
+        m_Used -= capacity;
+
+        if (m_FreeBytes + capacity <= max_free)
+        {
+            m_Free[capacity].push_back({ base, true });
+            m_FreeBytes += capacity;
+            return;
+        }
+    }
+
+    munmap(base, capacity);
+}
+
+uint64_t get_resident_memory()
+{
+    return read_status_kb("VmRSS") << 10;
+}
+
+uint64_t get_peak_resident_memory()
+{
+    return read_status_kb("VmHWM") << 10;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Recycles the memory images are decoded into.
+// stb_image's allocations go through here (see STBI_MALLOC in decoder.cc) as well as the
+// buffers images are scaled into. Big allocations are mapped separately, rounded up to a size
+// class and kept for reuse after they are freed, so decoding one large image after another
+// doesn't leave the heap fragmented and holding on to hundreds of MB. Small ones are left to
+// malloc. Thread safe.
+class PixelPool
+{
+public:
+    static PixelPool& get();
+
+    void* allocate(size_t size);
+    void* reallocate(void* p, size_t size);
+    void release(void* p);
+
+    // Gives the pages of free buffers back to the kernel, they stay mapped for reuse. The heap
+    // is trimmed too.
+    void trim();
+
+    // Bytes handed out from mapped buffers and kept in free ones
+    size_t get_used() const;
+    size_t get_free() const;
+    // Resident memory of the process right after the last trim
+    uint64_t get_idle_resident() const;
+
+private:
+    PixelPool() = default;
+
+    // Allocations from this size on are mapped
+    static constexpr size_t min_mapped{ 64 << 10 };
+    // Free buffers beyond this many bytes are unmapped
+    static constexpr size_t max_free{ 128 << 20 };
+
+    struct FreeBuffer
+    {
+        void* base;
+        // Whether its pages may still be resident
+        bool dirty;
+    };
+
+    void* map(size_t capacity);
+    // Takes ownership of a mapped buffer, keeping it if there is room
+    void recycle(void* base, size_t capacity);
+
+    mutable std::mutex m_Mutex;
+    // By capacity
+    std::map<size_t, std::vector<FreeBuffer>> m_Free;
+    size_t m_Used{ 0 }, m_FreeBytes{ 0 };
+    uint64_t m_IdleResident{ 0 };
+};
+
+// Resident memory of the process in bytes and the most it has been, 0 if it can't be read
+uint64_t get_resident_memory();
+uint64_t get_peak_resident_memory();
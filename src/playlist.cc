@@ -0,0 +1,307 @@
+#include "playlist.hh"
+
+#include <random/random.hh>
+using Random = effolkronium::random_static;
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    int64_t get_mtime(const struct stat& st)
+    {
+        return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+}
+
+Playlist::Playlist(const std::string& path)
+    : m_Path{ path },
+      m_Directory{ fs::absolute(path).parent_path().string() }
+{
+    // Kept open so changes to the file can be noticed through fstat
+    m_Fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_Fd < 0)
+        throw std::runtime_error(
+            fmt::format("Failed to open playlist {}: {}", path, strerror(errno)));
+
+    try
+    {
+        map();
+    }
+    catch (const std::runtime_error&)
+    {
+        close(m_Fd);
+        throw;
+    }
+}
+
+Playlist::~Playlist()
+{
+    unmap();
+    close(m_Fd);
+}
+
+void Playlist::map()
+{
+    struct stat st;
+    if (fstat(m_Fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size >= UINT32_MAX)
+        throw std::runtime_error(
+            fmt::format("Playlist {} is not a regular file smaller than 4 GiB", m_Path));
+
+    m_Size  = static_cast<uint32_t>(st.st_size);
+    m_MTime = get_mtime(st);
+
+    if (m_Size > 0)
+    {
+        void* data{ mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, m_Fd, 0) };
+        if (data == MAP_FAILED)
+        {
+            m_Size = 0;
+            throw std::runtime_error(
+                fmt::format("Failed to map playlist {}: {}", m_Path, strerror(errno)));
+        }
+
+        m_Data = static_cast<const char*>(data);
+
+        // find -print0 output has NUL bytes all through it, a list of lines has none
+        m_Separator = memchr(m_Data, '\0', std::min<size_t>(m_Size, 65536)) ? '\0' : '\n';
+    }
+
+    spdlog::debug(fmt::format("Mapped playlist {}, {} bytes", m_Path, m_Size));
+}
+
+void Playlist::unmap()
+{
+    if (m_Data)
+        munmap(const_cast<char*>(m_Data), m_Size);
+
+    m_Data          = nullptr;
+    m_Size          = 0;
+    m_Indexed       = 0;
+    m_ShortestEntry = UINT32_MAX;
+    m_Next          = 0;
+    m_Offsets.clear();
+    m_Removed.clear();
+    m_Recent.clear();
+}
+
+void Playlist::reload_if_changed()
+{
+    struct stat st;
+    if (fstat(m_Fd, &st) != 0 || (st.st_size == m_Size && get_mtime(st) == m_MTime))
+        return;
+
+    spdlog::info(fmt::format("Playlist {} changed, reading it again", m_Path));
+    unmap();
+
+    try
+    {
+        map();
+    }
+    catch (const std::runtime_error& e)
+    {
+        spdlog::error(e.what());
+    }
+}
+
+std::string Playlist::get_next(const Validator& validate)
+{
+    reload_if_changed();
+
+    for (int i = 0; i < max_tries; ++i)
+    {
+        if (m_Next == m_Offsets.size())
+        {
+            if (!is_indexed())
+            {
+                index_step_more();
+                continue;
+            }
+
+            if (m_Removed.size() >= m_Offsets.size())
+                break;
+
+            m_Next = 0;
+        }
+
+        if (auto path{ accept(m_Offsets[m_Next++], validate) }; !path.empty())
+            return path;
+    }
+
+    return {};
+}
+
+std::string Playlist::get_random(const Validator& validate)
+{
+    reload_if_changed();
+
+    if (!is_indexed())
+        index_step_more();
+
+    for (int i = 0; i < max_tries; ++i)
+    {
+        if (is_indexed() && m_Removed.size() >= m_Offsets.size())
+            break;
+
+        auto start{ pick_random_start() };
+        if (!start)
+            break;
+
+        if (auto path{ accept(*start, validate) }; !path.empty())
+            return path;
+    }
+
+    return {};
+}
+
+size_t Playlist::count_valid(const Validator& validate, size_t count)
+{
+    reload_if_changed();
+
+    size_t valid{ 0 };
+
+    for (size_t i = 0; valid < count; ++i)
+    {
+        if (i == m_Offsets.size())
+        {
+            if (is_indexed())
+                break;
+
+            index_step_more();
+            continue;
+        }
+
+        if (!accept(m_Offsets[i], validate).empty())
+            ++valid;
+    }
+
+    return valid;
+}
+
+void Playlist::remove(const std::string& path)
+{
+    auto it{ std::find_if(
+        m_Recent.begin(), m_Recent.end(), [&](const auto& r) { return r.first == path; }) };
+
+    if (it != m_Recent.end())
+    {
+        m_Removed.insert(it->second);
+        m_Recent.erase(it);
+    }
+}
+
+void Playlist::index_step_more()
+{
+    const char* p{ m_Data + m_Indexed };
+    const char* step_end{ m_Data + std::min<size_t>(size_t{ m_Indexed } + index_step, m_Size) };
+    const char* end{ m_Data + m_Size };
+
+    // Only whole entries, the last one may go past the step
+    while (p < step_end)
+    {
+        const auto* separator{ static_cast<const char*>(memchr(p, m_Separator, end - p)) };
+        if (!separator)
+            separator = end;
+
+        if (separator > p)
+        {
+            m_Offsets.push_back(static_cast<uint32_t>(p - m_Data));
+            m_ShortestEntry = std::min(m_ShortestEntry, static_cast<uint32_t>(separator - p));
+        }
+
+        p = separator + 1;
+    }
+
+    m_Indexed = static_cast<uint32_t>(std::min(p, end) - m_Data);
+
+    if (is_indexed())
+        spdlog::debug(fmt::format("Indexed all {} playlist entries", m_Offsets.size()));
+}
+
+uint32_t Playlist::find_start(uint32_t offset) const
+{
+    while (offset > 0 && m_Data[offset - 1] != m_Separator)
+        --offset;
+
+    return offset;
+}
+
+std::string_view Playlist::get_entry(uint32_t start) const
+{
+    const auto* p{ m_Data + start };
+    const auto* separator{ static_cast<const char*>(memchr(p, m_Separator, m_Size - start)) };
+    std::string_view entry{ p, separator ? static_cast<size_t>(separator - p) : m_Size - start };
+
+    // Lists written on Windows
+    if (m_Separator == '\n' && entry.ends_with('\r'))
+        entry.remove_suffix(1);
+
+    return entry;
+}
+
+std::string Playlist::accept(uint32_t start, const Validator& validate)
+{
+    if (m_Removed.contains(start))
+        return {};
+
+    auto entry{ get_entry(start) };
+    std::string path;
+
+    if (!entry.empty())
+    {
+        path = entry.front() == '/' ? std::string{ entry }
+                                    : m_Directory + "/" + std::string{ entry };
+    }
+
+    if (path.empty() || !validate(path))
+    {
+        m_Removed.insert(start);
+        return {};
+    }
+
+    m_Recent.emplace_back(path, start);
+    if (m_Recent.size() > max_recent)
+        m_Recent.pop_front();
+
+    return path;
+}
+
+std::optional<uint32_t> Playlist::pick_random_start() const
+{
+    // Every entry is equally likely once the whole file is indexed
+    if (is_indexed())
+    {
+        if (m_Offsets.empty())
+            return std::nullopt;
+
+        return m_Offsets[Random::get<size_t>(0, m_Offsets.size() - 1)];
+    }
+
+    // Until then a random byte is picked and its entry is kept with a probability inversely
+    // proportional to its length, so long paths aren't picked more often than short ones
+    for (int i = 0; i < max_tries; ++i)
+    {
+        auto offset{ Random::get<uint32_t>(0, m_Size - 1) };
+        if (m_Data[offset] == m_Separator)
+            continue;
+
+        auto start{ find_start(offset) };
+        auto len{ get_entry(start).size() };
+
+        if (i + 1 == max_tries ||
+            Random::get<size_t>(1, std::max<size_t>(len, 1)) <= m_ShortestEntry)
+            return start;
+    }
+
+    return std::nullopt;
+}
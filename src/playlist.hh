@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// A list of wallpaper paths read from a file, one per line or separated by NUL bytes like the
+// output of find -print0. Relative paths are relative to the directory of the file.
+// The file is mapped and its entries are indexed by offset a chunk at a time as they are
+// needed, so opening a list of millions of paths costs as little as opening a short one. Entries
+// are only checked once they are picked. A file that is rewritten in place is mapped again
+// from the start when its size or modification time changes, replacing it by renaming a new
+// file over it is still safer.
+class Playlist
+{
+public:
+    // Returns whether a picked path can be used
+    using Validator = std::function<bool(const std::string& path)>;
+
+    // Throws std::runtime_error if the file can't be mapped
+    explicit Playlist(const std::string& path);
+    ~Playlist();
+
+    Playlist(const Playlist&)            = delete;
+    Playlist& operator=(const Playlist&) = delete;
+
+    // Picks the entry after the last one picked, wrapping around at the end of the file, or a
+    // random entry. Entries that fail validate are skipped from then on, the result is empty
+    // if no valid entry was found.
+    std::string get_next(const Validator& validate);
+    std::string get_random(const Validator& validate);
+    // Checks entries in file order until count valid ones are found, returns how many were.
+    // Doesn't change what get_next() picks.
+    size_t count_valid(const Validator& validate, size_t count);
+    // Skips a recently picked path from now on, for files that fail to decode
+    void remove(const std::string& path);
+
+    // Entries indexed so far and whether that is all of them
+    size_t get_indexed() const { return m_Offsets.size(); }
+    bool is_indexed() const { return m_Indexed == m_Size; }
+
+private:
+    // Bytes indexed per step, each pick indexes at most one step more
+    static constexpr size_t index_step{ 1 << 20 };
+    // Tries to find a valid entry per pick
+    static constexpr int max_tries{ 64 };
+    // Recently picked entries remembered for remove()
+    static constexpr size_t max_recent{ 32 };
+
+    // Maps the file and resets the index, throws std::runtime_error if it can't
+    void map();
+    void unmap();
+    // Maps the file again if it changed since it was mapped, reading past the end of a
+    // truncated mapping would raise SIGBUS
+    void reload_if_changed();
+    // Indexes the entries starting in the next step of the file
+    void index_step_more();
+    // Start of the entry containing offset
+    uint32_t find_start(uint32_t offset) const;
+    std::string_view get_entry(uint32_t start) const;
+    // Checks the entry at start, returns its path if it is valid
+    std::string accept(uint32_t start, const Validator& validate);
+    // Nothing if no entry was found
+    std::optional<uint32_t> pick_random_start() const;
+
+    std::string m_Path, m_Directory;
+    int m_Fd{ -1 };
+    const char* m_Data{ nullptr };
+    uint32_t m_Size{ 0 };
+    // Of the file when it was mapped, in nanoseconds
+    int64_t m_MTime{ 0 };
+    char m_Separator{ '\n' };
+
+    // Start of every entry in the first m_Indexed bytes
+    std::vector<uint32_t> m_Offsets;
+    uint32_t m_Indexed{ 0 };
+    // Shortest entry indexed so far, used to pick entries of the rest of the file evenly
+    uint32_t m_ShortestEntry{ UINT32_MAX };
+    // Position in m_Offsets of the next entry get_next() tries
+    size_t m_Next{ 0 };
+
+    // Starts of entries that failed validation or decoding
+    std::unordered_set<uint32_t> m_Removed;
+    std::deque<std::pair<std::string, uint32_t>> m_Recent;
+};
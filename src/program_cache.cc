@@ -0,0 +1,134 @@
+#include "program_cache.hh"
+
+#include "glutil.hh"
+#include "hash.hh"
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    constexpr uint32_t binary_magic{ 0x50504c47 }; // "GLPP"
+
+    struct BinaryHeader
+    {
+        uint32_t magic;
+        uint32_t format;
+        uint64_t key;
+        uint64_t length;
+    };
+
+    std::string get_gl_string(GLenum name)
+    {
+        const auto* str{ reinterpret_cast<const char*>(glGetString(name)) };
+        return str ? str : "";
+    }
+}
+
+ProgramCache::ProgramCache(std::string directory) : m_Directory{ std::move(directory) }
+{
+    GLint n_formats{ 0 };
+
+    if (gl_version_at_least(4, 1) || gl_has_extension("GL_ARB_get_program_binary"))
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats);
+
+    if (n_formats <= 0)
+    {
+        spdlog::info("Driver doesn't support program binaries, shaders won't be cached");
+        return;
+    }
+
+    std::error_code ec;
+    fs::create_directories(m_Directory, ec);
+
+    m_Supported  = !ec;
+    m_DriverHash = fnv1a(get_gl_string(GL_VENDOR));
+    m_DriverHash = fnv1a(get_gl_string(GL_RENDERER), m_DriverHash);
+    m_DriverHash = fnv1a(get_gl_string(GL_VERSION), m_DriverHash);
+}
+
+uint64_t ProgramCache::get_key(const std::string& vert, const std::string& frag) const
+{
+    return fnv1a(frag, fnv1a(vert, m_DriverHash));
+}
+
+bool ProgramCache::load(uint64_t key, unsigned int program) const
+{
+    if (!m_Supported)
+        return false;
+
+    auto path{ get_binary_path(key) };
+    std::ifstream in{ path, std::ios::binary };
+    BinaryHeader header;
+
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != binary_magic || header.key != key)
+        return false;
+
+    std::vector<char> binary(header.length);
+    if (!in.read(binary.data(), binary.size()))
+        return false;
+
+    glProgramBinary(program, header.format, binary.data(), binary.size());
+
+    GLint linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    if (!linked)
+    {
+        // Most likely the driver changed in a way its version string doesn't show
+        spdlog::debug(fmt::format("Driver rejected cached program {}", path));
+        unlink(path.c_str());
+    }
+
+    return linked;
+}
+
+void ProgramCache::store(uint64_t key, unsigned int program) const
+{
+    if (!m_Supported)
+        return;
+
+    GLint length{ 0 };
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (length <= 0)
+        return;
+
+    BinaryHeader header{ binary_magic, 0, key, static_cast<uint64_t>(length) };
+    std::vector<char> binary(length);
+    glGetProgramBinary(program, length, nullptr, &header.format, binary.data());
+
+    // Write to a temporary file first so other instances never see a partial binary
+    auto path{ get_binary_path(key) };
+    auto tmp_path{ fmt::format(
+        "{}.{}.{}.tmp", path, getpid(), std::hash<std::thread::id>{}(std::this_thread::get_id())) };
+
+    {
+        std::ofstream out{ tmp_path, std::ios::binary | std::ios::trunc };
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(binary.data(), binary.size());
+
+        if (!out)
+        {
+            unlink(tmp_path.c_str());
+            return;
+        }
+    }
+
+    if (rename(tmp_path.c_str(), path.c_str()) != 0)
+        unlink(tmp_path.c_str());
+}
+
+std::string ProgramCache::get_binary_path(uint64_t key) const
+{
+    return fmt::format("{}/{:016x}.bin", m_Directory, key);
+}
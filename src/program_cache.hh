@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// On-disk cache of linked program binaries.
+// Binaries are keyed by the GL vendor, renderer and version strings plus the shader sources,
+// so a driver update or a different GPU never gets handed a stale binary. Must be created on
+// the render thread.
+class ProgramCache
+{
+public:
+    ProgramCache(std::string directory);
+
+    // Whether the driver can save and load program binaries at all
+    bool is_supported() const { return m_Supported; }
+
+    uint64_t get_key(const std::string& vert, const std::string& frag) const;
+
+    // Loads the cached binary for key into program, returns false on a miss or if the
+    // driver rejected the binary
+    bool load(uint64_t key, unsigned int program) const;
+    // Stores the binary of the linked program
+    void store(uint64_t key, unsigned int program) const;
+
+private:
+    std::string get_binary_path(uint64_t key) const;
+
+    std::string m_Directory;
+    bool m_Supported{ false };
+    uint64_t m_DriverHash{ 0 };
+};
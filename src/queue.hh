@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded lock-free multi-producer/multi-consumer queue.
+// Each cell carries a sequence number that tells producers and consumers whether it is
+// free to be written or ready to be read, so neither side ever takes a lock.
+template<typename T, size_t Capacity>
+class AtomicQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "AtomicQueue capacity must be a power of two");
+
+public:
+    AtomicQueue()
+    {
+        for (size_t i = 0; i < Capacity; ++i)
+            m_Cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // Returns false if the queue is full
+    bool push(T&& value)
+    {
+        size_t pos{ m_Tail.load(std::memory_order_relaxed) };
+        Cell* cell;
+
+        while (true)
+        {
+            cell = &m_Cells[pos & (Capacity - 1)];
+            size_t seq{ cell->seq.load(std::memory_order_acquire) };
+            auto diff{ static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos) };
+
+            if (diff == 0)
+            {
+                if (m_Tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_Tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = std::move(value);
+        cell->seq.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool pop(T& out)
+    {
+        size_t pos{ m_Head.load(std::memory_order_relaxed) };
+        Cell* cell;
+
+        while (true)
+        {
+            cell = &m_Cells[pos & (Capacity - 1)];
+            size_t seq{ cell->seq.load(std::memory_order_acquire) };
+            auto diff{ static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1) };
+
+            if (diff == 0)
+            {
+                if (m_Head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_Head.load(std::memory_order_relaxed);
+            }
+        }
+
+        out = std::move(cell->value);
+        cell->seq.store(pos + Capacity, std::memory_order_release);
+
+        return true;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::array<Cell, Capacity> m_Cells;
+    alignas(64) std::atomic<size_t> m_Head{ 0 };
+    alignas(64) std::atomic<size_t> m_Tail{ 0 };
+};
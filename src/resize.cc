@@ -0,0 +1,453 @@
+#include "resize.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Adds weight * row[i] to acc[i] for n bytes
+    using AccumulateFunc = void (*)(float* acc, const unsigned char* row, size_t n, float weight);
+
+    void accumulate_scalar(float* acc, const unsigned char* row, size_t n, float weight)
+    {
+        for (size_t i = 0; i < n; ++i)
+            acc[i] += weight * row[i];
+    }
+
+#ifdef HAVE_X86_KERNELS
+    __attribute__((target("sse4.1"))) void
+    accumulate_sse41(float* acc, const unsigned char* row, size_t n, float weight)
+    {
+        const __m128 w{ _mm_set1_ps(weight) };
+        size_t i{ 0 };
+
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i px{ _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)) };
+
+            for (int j = 0; j < 4; ++j)
+            {
+                __m128 f{ _mm_cvtepi32_ps(_mm_cvtepu8_epi32(px)) };
+                _mm_storeu_ps(acc + i + j * 4,
+                              _mm_add_ps(_mm_loadu_ps(acc + i + j * 4), _mm_mul_ps(f, w)));
+                px = _mm_srli_si128(px, 4);
+            }
+        }
+
+        accumulate_scalar(acc + i, row + i, n - i, weight);
+    }
+
+    __attribute__((target("avx2,fma"))) void
+    accumulate_avx2(float* acc, const unsigned char* row, size_t n, float weight)
+    {
+        const __m256 w{ _mm256_set1_ps(weight) };
+        size_t i{ 0 };
+
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i px{ _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)) };
+            __m256 lo{ _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(px)) };
+            __m256 hi{ _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(px, 8))) };
+
+            _mm256_storeu_ps(acc + i, _mm256_fmadd_ps(lo, w, _mm256_loadu_ps(acc + i)));
+            _mm256_storeu_ps(acc + i + 8, _mm256_fmadd_ps(hi, w, _mm256_loadu_ps(acc + i + 8)));
+        }
+
+        accumulate_scalar(acc + i, row + i, n - i, weight);
+    }
+#endif
+
+    // Precomputed source spans of every destination column, shared by all strips
+    struct Plan
+    {
+        Plan(int src_w, int src_h, int dst_w, int dst_h)
+        {
+            // Crop to the destination's aspect ratio, centered
+            if (static_cast<int64_t>(src_w) * dst_h > static_cast<int64_t>(src_h) * dst_w)
+            {
+                crop_h = src_h;
+                crop_w = std::max(1, static_cast<int>(std::lround(
+                                         static_cast<double>(src_h) * dst_w / dst_h)));
+            }
+            else
+            {
+                crop_w = src_w;
+                crop_h = std::max(1, static_cast<int>(std::lround(
+                                         static_cast<double>(src_w) * dst_h / dst_w)));
+            }
+
+            crop_x = (src_w - crop_w) / 2;
+            crop_y = (src_h - crop_h) / 2;
+            scale_x = static_cast<double>(crop_w) / dst_w;
+            scale_y = static_cast<double>(crop_h) / dst_h;
+
+            x_start.resize(dst_w);
+            x_count.resize(dst_w);
+            x_offset.resize(dst_w);
+            x_norm.resize(dst_w);
+
+            for (int x = 0; x < dst_w; ++x)
+            {
+                double x0{ x * scale_x }, x1{ std::min((x + 1) * scale_x, double(crop_w)) };
+                int first{ static_cast<int>(x0) };
+                int last{ std::min(static_cast<int>(std::ceil(x1)), crop_w) };
+                double sum{ 0 };
+
+                x_start[x]  = first;
+                x_count[x]  = std::max(last - first, 1);
+                x_offset[x] = x_weights.size();
+
+                for (int i = first; i < first + x_count[x]; ++i)
+                {
+                    double w{ std::max(std::min<double>(i + 1, x1) - std::max<double>(i, x0), 0.0) };
+                    x_weights.push_back(static_cast<float>(w));
+                    sum += w;
+                }
+
+                x_norm[x] = sum > 0 ? static_cast<float>(1.0 / sum) : 0.0f;
+            }
+        }
+
+        int crop_x, crop_y, crop_w, crop_h;
+        double scale_x, scale_y;
+
+        std::vector<int> x_start, x_count;
+        std::vector<size_t> x_offset;
+        std::vector<float> x_weights, x_norm;
+    };
+
+    // Range of source rows destination row y covers, within the crop
+    std::pair<int, int> get_row_span(const Plan& plan, int y)
+    {
+        double y1{ std::min((y + 1) * plan.scale_y, double(plan.crop_h)) };
+        int first{ static_cast<int>(y * plan.scale_y) };
+        int last{ std::max(std::min(static_cast<int>(std::ceil(y1)), plan.crop_h), first + 1) };
+
+        return { first, last };
+    }
+
+    // Weight of source row r in destination row y
+    double get_row_weight(const Plan& plan, int y, int r)
+    {
+        double y0{ y * plan.scale_y };
+        double y1{ std::min((y + 1) * plan.scale_y, double(plan.crop_h)) };
+
+        return std::max(std::min<double>(r + 1, y1) - std::max<double>(r, y0), 0.0);
+    }
+
+    // Horizontal pass over the accumulated source rows of one destination row. acc has one
+    // float of padding past the crop so a pixel can be loaded as four floats.
+    using WriteRowFunc = void (*)(
+        const Plan& plan, const float* acc, float y_norm, unsigned char* out, int dst_w);
+
+    void write_row_scalar(
+        const Plan& plan, const float* acc, float y_norm, unsigned char* out, int dst_w)
+    {
+        for (int x = 0; x < dst_w; ++x)
+        {
+            const float* px{ acc + plan.x_start[x] * 3 };
+            const float* w{ plan.x_weights.data() + plan.x_offset[x] };
+            float r{ 0 }, g{ 0 }, b{ 0 };
+
+            for (int i = 0; i < plan.x_count[x]; ++i, px += 3)
+            {
+                r += w[i] * px[0];
+                g += w[i] * px[1];
+                b += w[i] * px[2];
+            }
+
+            float norm{ plan.x_norm[x] * y_norm };
+            out[x * 3 + 0] = static_cast<unsigned char>(std::min(r * norm + 0.5f, 255.0f));
+            out[x * 3 + 1] = static_cast<unsigned char>(std::min(g * norm + 0.5f, 255.0f));
+            out[x * 3 + 2] = static_cast<unsigned char>(std::min(b * norm + 0.5f, 255.0f));
+        }
+    }
+
+#ifdef HAVE_X86_KERNELS
+    // Keeps a pixel's three channels in one vector, the fourth lane is the next pixel's red and
+    // is thrown away. Same operations in the same order as the scalar version.
+    __attribute__((target("sse4.1"))) void
+    write_row_sse41(const Plan& plan, const float* acc, float y_norm, unsigned char* out, int dst_w)
+    {
+        const __m128 half{ _mm_set1_ps(0.5f) }, max{ _mm_set1_ps(255.0f) };
+
+        for (int x = 0; x < dst_w; ++x)
+        {
+            const float* px{ acc + plan.x_start[x] * 3 };
+            const float* w{ plan.x_weights.data() + plan.x_offset[x] };
+            __m128 sum{ _mm_setzero_ps() };
+
+            for (int i = 0; i < plan.x_count[x]; ++i, px += 3)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[i]), _mm_loadu_ps(px)));
+
+            __m128 norm{ _mm_set1_ps(plan.x_norm[x] * y_norm) };
+            __m128 value{ _mm_min_ps(_mm_add_ps(_mm_mul_ps(sum, norm), half), max) };
+            __m128i rgb{ _mm_cvttps_epi32(value) };
+            rgb = _mm_packus_epi16(_mm_packus_epi32(rgb, rgb), rgb);
+
+            uint32_t bytes{ static_cast<uint32_t>(_mm_cvtsi128_si32(rgb)) };
+            std::memcpy(out + x * 3, &bytes, 3);
+        }
+    }
+#endif
+
+    struct Kernel
+    {
+        const char* name;
+        AccumulateFunc accumulate;
+        WriteRowFunc write_row;
+    };
+
+    constexpr Kernel scalar_kernel{ "scalar", accumulate_scalar, write_row_scalar };
+
+    // Kernels this CPU can run, fastest first
+    std::vector<Kernel> get_kernels()
+    {
+        std::vector<Kernel> kernels;
+
+#ifdef HAVE_X86_KERNELS
+        __builtin_cpu_init();
+
+        // The horizontal pass only ever works on one pixel at a time, AVX2 wouldn't help it
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            kernels.push_back({ "avx2", accumulate_avx2, write_row_sse41 });
+        if (__builtin_cpu_supports("sse4.1"))
+            kernels.push_back({ "sse4.1", accumulate_sse41, write_row_sse41 });
+#endif
+
+        kernels.push_back(scalar_kernel);
+
+        return kernels;
+    }
+
+    const Kernel& get_kernel()
+    {
+        static const Kernel kernel{ get_kernels().front() };
+        return kernel;
+    }
+
+    void resize_rows(const Plan& plan,
+                     const Kernel& kernel,
+                     const unsigned char* src,
+                     size_t src_stride,
+                     unsigned char* dst,
+                     size_t dst_stride,
+                     int dst_w,
+                     int row_begin,
+                     int row_end)
+    {
+        const size_t n{ static_cast<size_t>(plan.crop_w) * 3 };
+        const unsigned char* origin{ src + plan.crop_y * src_stride + plan.crop_x * 3 };
+        std::vector<float> acc(n + 1);
+
+        for (int y = row_begin; y < row_end; ++y)
+        {
+            auto [first, last]{ get_row_span(plan, y) };
+            double y_sum{ 0 };
+
+            // Vertical pass, sums the source rows covered by this destination row
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            for (int r = first; r < last; ++r)
+            {
+                double w{ get_row_weight(plan, y, r) };
+                kernel.accumulate(acc.data(), origin + r * src_stride, n, static_cast<float>(w));
+                y_sum += w;
+            }
+
+            float y_norm{ y_sum > 0 ? static_cast<float>(1.0 / y_sum) : 0.0f };
+            kernel.write_row(plan, acc.data(), y_norm, dst + y * dst_stride, dst_w);
+        }
+    }
+}
+
+std::pair<int, int> get_cover_size(int src_w, int src_h, int dst_w, int dst_h)
+{
+    Plan plan{ src_w, src_h, dst_w, dst_h };
+
+    if (plan.crop_w <= dst_w || plan.crop_h <= dst_h)
+        return { plan.crop_w, plan.crop_h };
+
+    return { dst_w, dst_h };
+}
+
+void resize_cover(const unsigned char* src,
+                  int src_w,
+                  int src_h,
+                  size_t src_stride,
+                  unsigned char* dst,
+                  int dst_w,
+                  int dst_h,
+                  size_t dst_stride,
+                  unsigned int n_threads)
+{
+    Plan plan{ src_w, src_h, dst_w, dst_h };
+    const auto& kernel{ get_kernel() };
+
+    // Don't bother splitting tiny images into strips
+    n_threads = std::clamp(n_threads, 1u, static_cast<unsigned int>(std::max(dst_h / 64, 1)));
+
+    std::vector<std::thread> threads;
+    int strip{ (dst_h + static_cast<int>(n_threads) - 1) / static_cast<int>(n_threads) };
+
+    for (unsigned int i = 1; i < n_threads; ++i)
+    {
+        int begin{ static_cast<int>(i) * strip }, end{ std::min(begin + strip, dst_h) };
+        if (begin < end)
+            threads.emplace_back(resize_rows,
+                                 std::cref(plan),
+                                 std::cref(kernel),
+                                 src,
+                                 src_stride,
+                                 dst,
+                                 dst_stride,
+                                 dst_w,
+                                 begin,
+                                 end);
+    }
+
+    resize_rows(plan, kernel, src, src_stride, dst, dst_stride, dst_w, 0, std::min(strip, dst_h));
+
+    for (auto& t : threads)
+        t.join();
+}
+
+void resize_cover_scalar(const unsigned char* src,
+                         int src_w,
+                         int src_h,
+                         size_t src_stride,
+                         unsigned char* dst,
+                         int dst_w,
+                         int dst_h,
+                         size_t dst_stride)
+{
+    Plan plan{ src_w, src_h, dst_w, dst_h };
+    resize_rows(plan, scalar_kernel, src, src_stride, dst, dst_stride, dst_w, 0, dst_h);
+}
+
+struct StripResizer::State
+{
+    State(int src_w, int src_h, int dst_w, int dst_h) : plan{ src_w, src_h, dst_w, dst_h } {}
+
+    Plan plan;
+    const Kernel& kernel{ get_kernel() };
+
+    unsigned char* dst;
+    int dst_w, dst_h;
+    size_t dst_stride;
+    bool flip;
+
+    // Sums of the source rows of the destination row being built, with the padding
+    // write_row needs
+    std::vector<float> acc;
+    size_t n;
+    double y_sum{ 0 };
+    // Next source row pushed and the destination row it goes into
+    int src_y{ 0 }, y{ 0 };
+};
+
+StripResizer::StripResizer(int src_w,
+                           int src_h,
+                           unsigned char* dst,
+                           int dst_w,
+                           int dst_h,
+                           size_t dst_stride,
+                           bool flip_vertically)
+    : m_State{ std::make_unique<State>(src_w, src_h, dst_w, dst_h) }
+{
+    m_State->dst        = dst;
+    m_State->dst_w      = dst_w;
+    m_State->dst_h      = dst_h;
+    m_State->dst_stride = dst_stride;
+    m_State->flip       = flip_vertically;
+    m_State->n = static_cast<size_t>(m_State->plan.crop_w) * 3;
+    m_State->acc.resize(m_State->n + 1);
+}
+
+StripResizer::~StripResizer() = default;
+
+void StripResizer::push(const unsigned char* rows, size_t stride, int n_rows)
+{
+    auto& s{ *m_State };
+    const auto& plan{ s.plan };
+
+    for (int i = 0; i < n_rows; ++i)
+    {
+        // Rows above and below the crop are skipped
+        int r{ s.src_y++ - plan.crop_y };
+        if (r < 0 || r >= plan.crop_h)
+            continue;
+
+        const unsigned char* row{ rows + i * stride + plan.crop_x * 3 };
+
+        // A row can straddle two destination rows
+        while (s.y < s.dst_h)
+        {
+            auto [first, last]{ get_row_span(plan, s.y) };
+            if (r < first)
+                break;
+
+            double w{ get_row_weight(plan, s.y, r) };
+            s.kernel.accumulate(s.acc.data(), row, s.n, static_cast<float>(w));
+            s.y_sum += w;
+
+            if (r + 1 < last)
+                break;
+
+            int out{ s.flip ? s.dst_h - 1 - s.y : s.y };
+            float y_norm{ s.y_sum > 0 ? static_cast<float>(1.0 / s.y_sum) : 0.0f };
+            s.kernel.write_row(plan, s.acc.data(), y_norm, s.dst + out * s.dst_stride, s.dst_w);
+
+            std::fill(s.acc.begin(), s.acc.end(), 0.0f);
+            s.y_sum = 0;
+            ++s.y;
+        }
+    }
+}
+
+bool StripResizer::is_done() const
+{
+    return m_State->y == m_State->dst_h;
+}
+
+std::vector<const char*> get_resize_kernels()
+{
+    std::vector<const char*> names;
+    for (const auto& kernel : get_kernels())
+        names.push_back(kernel.name);
+
+    return names;
+}
+
+void resize_cover_kernel(const char* kernel,
+                         const unsigned char* src,
+                         int src_w,
+                         int src_h,
+                         size_t src_stride,
+                         unsigned char* dst,
+                         int dst_w,
+                         int dst_h,
+                         size_t dst_stride)
+{
+    Plan plan{ src_w, src_h, dst_w, dst_h };
+    Kernel picked{ scalar_kernel };
+
+    for (const auto& k : get_kernels())
+        if (std::strcmp(k.name, kernel) == 0)
+            picked = k;
+
+    resize_rows(plan, picked, src, src_stride, dst, dst_stride, dst_w, 0, dst_h);
+}
+
+const char* get_resize_kernel_name()
+{
+    return get_kernel().name;
+}
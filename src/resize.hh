@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Rows of resized images are padded to this many bytes so they can be uploaded with the
+// default GL_UNPACK_ALIGNMENT
+constexpr size_t row_alignment{ 4 };
+
+constexpr size_t get_aligned_stride(int width)
+{
+    return (static_cast<size_t>(width) * 3 + row_alignment - 1) & ~(row_alignment - 1);
+}
+
+// Size an RGB image of src_w x src_h ends up at when it is cover-fit onto a dst_w x dst_h
+// screen. The source is cropped to the screen's aspect ratio and only ever scaled down,
+// upscaling is left to the GPU's texture filtering.
+std::pair<int, int> get_cover_size(int src_w, int src_h, int dst_w, int dst_h);
+
+// Crops src to the aspect ratio of dst and area-averages it down to dst_w x dst_h, where
+// dst_w x dst_h is the result of get_cover_size(). The destination rows are split into
+// strips that are resized on n_threads threads.
+void resize_cover(const unsigned char* src,
+                  int src_w,
+                  int src_h,
+                  size_t src_stride,
+                  unsigned char* dst,
+                  int dst_w,
+                  int dst_h,
+                  size_t dst_stride,
+                  unsigned int n_threads = 1);
+
+// Single threaded plain C++ version of resize_cover(), the SIMD kernels are measured and
+// validated against it
+void resize_cover_scalar(const unsigned char* src,
+                         int src_w,
+                         int src_h,
+                         size_t src_stride,
+                         unsigned char* dst,
+                         int dst_w,
+                         int dst_h,
+                         size_t dst_stride);
+
+// Does what resize_cover() does with the source fed to it a few rows at a time as they are
+// decoded, so images far bigger than the screen never have to be held in memory whole. Only
+// one row of sums the width of the source is kept, the result is the same as resize_cover()'s.
+class StripResizer
+{
+public:
+    // dst must stay valid until every row has been pushed. With flip_vertically the first
+    // source row ends up in the last row of dst, like stb_image's flip on load.
+    StripResizer(int src_w,
+                 int src_h,
+                 unsigned char* dst,
+                 int dst_w,
+                 int dst_h,
+                 size_t dst_stride,
+                 bool flip_vertically = false);
+    ~StripResizer();
+
+    StripResizer(const StripResizer&)            = delete;
+    StripResizer& operator=(const StripResizer&) = delete;
+
+    // Takes the next n_rows rows of the source, top to bottom
+    void push(const unsigned char* rows, size_t stride, int n_rows);
+    // Whether every row of dst has been written, the rest of the source isn't needed
+    bool is_done() const;
+
+private:
+    struct State;
+    std::unique_ptr<State> m_State;
+};
+
+// Names of the kernels this CPU can run, the one resize_cover() picks first. Only x86 has
+// SIMD kernels, everything else uses the scalar one.
+std::vector<const char*> get_resize_kernels();
+
+// Single threaded resize_cover() with a kernel from get_resize_kernels(), so the benchmark can
+// check every one of them. Unknown names use the scalar kernel.
+void resize_cover_kernel(const char* kernel,
+                         const unsigned char* src,
+                         int src_w,
+                         int src_h,
+                         size_t src_stride,
+                         unsigned char* dst,
+                         int dst_w,
+                         int dst_h,
+                         size_t dst_stride);
+
+// Name of the kernel resize_cover() picked for this CPU
+const char* get_resize_kernel_name();
@@ -0,0 +1,176 @@
+#include "root_pixmap.hh"
+
+#include "resize.hh"
+
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <cstdlib>
+#include <cstring>
+#include <spdlog/spdlog.h>
+
+namespace
+{
+    Pixmap get_pixmap_property(Display* display, Window root, const char* name)
+    {
+        Atom type;
+        int format;
+        unsigned long n_items, bytes_after;
+        unsigned char* data{ nullptr };
+        Pixmap pixmap{ None };
+
+        if (XGetWindowProperty(display,
+                               root,
+                               XInternAtom(display, name, true),
+                               0,
+                               1,
+                               false,
+                               XA_PIXMAP,
+                               &type,
+                               &format,
+                               &n_items,
+                               &bytes_after,
+                               &data) == Success &&
+            type == XA_PIXMAP && n_items == 1)
+        {
+            // Format 32 properties are returned as longs
+            pixmap = *reinterpret_cast<Pixmap*>(data);
+        }
+
+        if (data)
+            XFree(data);
+
+        return pixmap;
+    }
+
+    int ignore_errors(Display*, XErrorEvent*) { return 0; }
+}
+
+bool set_root_pixmap(Display* display, const unsigned char* bgra, int width, int height)
+{
+    // The pixmap is created on a connection of its own that is closed with RetainPermanent.
+    // It outlives that connection, and whoever sets the next wallpaper can free it with
+    // XKillClient without taking glpaper down with it.
+    Display* conn{ XOpenDisplay(DisplayString(display)) };
+    if (!conn)
+    {
+        spdlog::error("Failed to open a connection for the root pixmap");
+        return false;
+    }
+
+    int screen{ DefaultScreen(conn) };
+    Window root{ RootWindow(conn, screen) };
+    int depth{ DefaultDepth(conn, screen) };
+    Visual* visual{ DefaultVisual(conn, screen) };
+
+    if ((depth != 24 && depth != 32) || visual->red_mask != 0xff0000 ||
+        visual->green_mask != 0xff00 || visual->blue_mask != 0xff)
+    {
+        spdlog::warn(fmt::format("Root pixmap is not supported with a depth of {}", depth));
+        XCloseDisplay(conn);
+        return false;
+    }
+
+    // XImage wants the rows top-down, it frees data when it is destroyed
+    size_t row{ static_cast<size_t>(width) * 4 };
+    auto* data{ static_cast<char*>(malloc(row * height)) };
+    for (int y = 0; y < height; ++y)
+        memcpy(data + y * row, bgra + (height - 1 - y) * row, row);
+
+    XImage* image{ XCreateImage(conn, visual, depth, ZPixmap, 0, data, width, height, 32, 0) };
+    // BGRA bytes are a little-endian 0xAARRGGBB, Xlib converts if the server differs
+    image->byte_order = LSBFirst;
+
+    Pixmap pixmap{ XCreatePixmap(conn, root, width, height, depth) };
+    GC gc{ XCreateGC(conn, pixmap, 0, nullptr) };
+    XPutImage(conn, pixmap, gc, image, 0, 0, 0, 0, width, height);
+    XFreeGC(conn, gc);
+    XDestroyImage(image);
+
+    // Free the previous setter's pixmap, but only if it is still the one in use
+    Pixmap old_root{ get_pixmap_property(conn, root, "_XROOTPMAP_ID") };
+    Pixmap old_esetroot{ get_pixmap_property(conn, root, "ESETROOT_PMAP_ID") };
+    if (old_root != None && old_root == old_esetroot)
+        XKillClient(conn, old_esetroot);
+
+    for (auto name : { "_XROOTPMAP_ID", "ESETROOT_PMAP_ID" })
+    {
+        XChangeProperty(conn,
+                        root,
+                        XInternAtom(conn, name, false),
+                        XA_PIXMAP,
+                        32,
+                        PropModeReplace,
+                        reinterpret_cast<unsigned char*>(&pixmap),
+                        1);
+    }
+
+    XSetWindowBackgroundPixmap(conn, root, pixmap);
+    XClearWindow(conn, root);
+
+    XSetCloseDownMode(conn, RetainPermanent);
+    XCloseDisplay(conn);
+
+    return true;
+}
+
+std::optional<Image> read_root_pixmap(Display* display, int width, int height)
+{
+    Window root{ DefaultRootWindow(display) };
+    Pixmap pixmap{ get_pixmap_property(display, root, "_XROOTPMAP_ID") };
+    if (pixmap == None)
+        return std::nullopt;
+
+    // The pixmap can be freed by another setter at any time, don't let that be fatal
+    XSync(display, false);
+    auto old_handler{ XSetErrorHandler(ignore_errors) };
+    XImage* image{ XGetImage(display, pixmap, 0, 0, width, height, AllPlanes, ZPixmap) };
+    XSync(display, false);
+    XSetErrorHandler(old_handler);
+
+    if (!image)
+        return std::nullopt;
+
+    Image img;
+    img.width  = width;
+    img.height = height;
+    img.stride = get_aligned_stride(width);
+    img.pixels = { static_cast<unsigned char*>(malloc(img.stride * height)), free };
+
+    bool direct{ image->bits_per_pixel == 32 && image->byte_order == LSBFirst &&
+                 image->red_mask == 0xff0000 && image->green_mask == 0xff00 &&
+                 image->blue_mask == 0xff };
+
+    for (int y = 0; y < height; ++y)
+    {
+        auto* dst{ img.pixels.get() + (height - 1 - y) * img.stride };
+        const auto* src{ reinterpret_cast<const unsigned char*>(image->data) +
+                         y * image->bytes_per_line };
+
+        for (int x = 0; x < width; ++x, dst += 3)
+        {
+            unsigned long pixel{ direct ? 0ul : XGetPixel(image, x, y) };
+            dst[0] = direct ? src[x * 4 + 2] : (pixel >> 16) & 0xff;
+            dst[1] = direct ? src[x * 4 + 1] : (pixel >> 8) & 0xff;
+            dst[2] = direct ? src[x * 4] : pixel & 0xff;
+        }
+    }
+
+    XDestroyImage(image);
+
+    return img;
+}
+
+std::optional<Image> read_root_pixmap(const char* display_name, int width, int height)
+{
+    Display* conn{ XOpenDisplay(display_name) };
+    if (!conn)
+    {
+        spdlog::error("Failed to open a connection to read the root pixmap");
+        return std::nullopt;
+    }
+
+    auto img{ read_root_pixmap(conn, width, height) };
+    XCloseDisplay(conn);
+
+    return img;
+}
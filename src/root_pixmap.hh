@@ -0,0 +1,18 @@
+#pragma once
+
+#include <X11/Xlib.h>
+#include <optional>
+
+#include "image.hh"
+
+// Sets width x height BGRA pixels, rows bottom-up as read from GL, as the root window's
+// background the way Esetroot does (_XROOTPMAP_ID and ESETROOT_PMAP_ID), so the wallpaper
+// stays up without a window and pseudo-transparent clients can find it. Returns false if the
+// root window's visual isn't 24-bit TrueColor.
+bool set_root_pixmap(Display* display, const unsigned char* bgra, int width, int height);
+
+// Reads back the current root pixmap, which may have been set by another program, as a
+// bottom-up RGB image
+std::optional<Image> read_root_pixmap(Display* display, int width, int height);
+// Same on a connection of its own to display_name, so it can be called from another thread
+std::optional<Image> read_root_pixmap(const char* display_name, int width, int height);
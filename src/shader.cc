@@ -1,15 +1,105 @@
 #include "shader.hh"
 
+#include "deletion_queue.hh"
+#include "program_cache.hh"
+
 #include <GL/gl.h>
+#include <GL/glext.h>
+#include <algorithm>
 #include <spdlog/spdlog.h>
 
-Shader::Shader(const std::string& vert, const std::string& frag) : m_ProgramID{ glCreateProgram() }
+namespace
+{
+    std::initializer_list<GLenum> get_types(UniformKind kind)
+    {
+        switch (kind)
+        {
+        case UniformKind::Int:
+            return UniformTypes<int>::types;
+        case UniformKind::Float:
+            return UniformTypes<float>::types;
+        case UniformKind::Vec2:
+            return UniformTypes<std::array<float, 2>>::types;
+        case UniformKind::Vec3:
+            return UniformTypes<std::array<float, 3>>::types;
+        case UniformKind::Vec4:
+            return UniformTypes<std::array<float, 4>>::types;
+        }
+
+        return {};
+    }
+}
+
+Shader::Shader(const std::string& vert,
+               const std::string& frag,
+               const ProgramCache* cache,
+               std::span<const TransitionUniform> uniforms)
+    : m_ProgramID{ glCreateProgram() },
+      m_Cache{ cache },
+      m_DeclaredUniforms{ uniforms }
 {
+    if (m_Cache && m_Cache->is_supported())
+    {
+        m_CacheKey = m_Cache->get_key(vert, frag);
+
+        if (m_Cache->load(*m_CacheKey, m_ProgramID))
+        {
+            m_Finished = true;
+            reflect();
+            return;
+        }
+
+        glProgramParameteri(m_ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // Nothing here queries the compile status, that would wait for the driver
     static const auto compile_shader = [](GLenum type, const char* src) -> GLuint {
         GLuint id{ glCreateShader(type) };
         glShaderSource(id, 1, &src, nullptr);
         glCompileShader(id);
 
+        return id;
+    };
+
+    m_VertID = compile_shader(GL_VERTEX_SHADER, vert.c_str());
+    m_FragID = compile_shader(GL_FRAGMENT_SHADER, frag.c_str());
+
+    glAttachShader(m_ProgramID, m_VertID);
+    glAttachShader(m_ProgramID, m_FragID);
+    glLinkProgram(m_ProgramID);
+}
+
+Shader::~Shader()
+{
+    if (!m_Finished)
+    {
+        glDeleteShader(m_VertID);
+        glDeleteShader(m_FragID);
+    }
+
+    if (m_ProgramID)
+        DeletionQueue::get().delete_program(m_ProgramID);
+}
+
+bool Shader::is_ready() const
+{
+    if (m_Finished)
+        return true;
+
+    GLint done{ GL_TRUE };
+    glGetProgramiv(m_ProgramID, GL_COMPLETION_STATUS_KHR, &done);
+
+    return done;
+}
+
+void Shader::finish()
+{
+    if (m_Finished)
+        return;
+
+    m_Finished = true;
+
+    static const auto log_shader_errors = [](GLuint id) {
         GLint result;
         glGetShaderiv(id, GL_COMPILE_STATUS, &result);
         if (!result)
@@ -19,51 +109,100 @@ Shader::Shader(const std::string& vert, const std::string& frag) : m_ProgramID{
             std::string msg(length, ' ');
             glGetShaderInfoLog(id, length, &length, &msg[0]);
             spdlog::error(fmt::format("Failed to compile shader:\n{}", msg));
-
-            glDeleteShader(id);
-            return 0;
         }
-
-        return id;
     };
 
-    GLuint vs{ compile_shader(GL_VERTEX_SHADER, vert.c_str()) };
-    GLuint fs{ compile_shader(GL_FRAGMENT_SHADER, frag.c_str()) };
+    GLint result;
+    glGetProgramiv(m_ProgramID, GL_LINK_STATUS, &result);
 
-    glAttachShader(m_ProgramID, vs);
-    glAttachShader(m_ProgramID, fs);
-    glLinkProgram(m_ProgramID);
-    glValidateProgram(m_ProgramID);
+    if (!result)
+    {
+        log_shader_errors(m_VertID);
+        log_shader_errors(m_FragID);
 
-    glDeleteShader(vs);
-    glDeleteShader(fs);
-}
+        GLint length;
+        glGetProgramiv(m_ProgramID, GL_INFO_LOG_LENGTH, &length);
+        std::string msg(length, ' ');
+        glGetProgramInfoLog(m_ProgramID, length, &length, &msg[0]);
+        spdlog::error(fmt::format("Failed to link program:\n{}", msg));
+    }
 
-Shader::~Shader()
-{
-    glDeleteProgram(m_ProgramID);
-}
+    glDetachShader(m_ProgramID, m_VertID);
+    glDetachShader(m_ProgramID, m_FragID);
+    glDeleteShader(m_VertID);
+    glDeleteShader(m_FragID);
 
-void Shader::set_1i(std::string_view name, int value) const
-{
-    GLint loc{ glGetUniformLocation(m_ProgramID, name.data()) };
-    glUniform1i(loc, value);
-}
+    if (!result)
+    {
+        glDeleteProgram(m_ProgramID);
+        m_ProgramID = 0;
+        return;
+    }
 
-void Shader::set_1f(std::string_view name, float value) const
-{
-    GLint loc{ glGetUniformLocation(m_ProgramID, name.data()) };
-    glUniform1f(loc, value);
+    reflect();
+
+    if (m_CacheKey)
+        m_Cache->store(*m_CacheKey, m_ProgramID);
 }
 
-void Shader::set_2f(std::string_view name, const std::array<float, 2>& v) const
+void Shader::reflect()
 {
-    GLint loc{ glGetUniformLocation(m_ProgramID, name.data()) };
-    glUniform2f(loc, v[0], v[1]);
+    GLint count{ 0 }, max_length{ 0 };
+    glGetProgramiv(m_ProgramID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(m_ProgramID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+    std::string name(max_length, ' ');
+    m_Uniforms.clear();
+    m_Uniforms.reserve(count);
+
+    for (GLint i = 0; i < count; ++i)
+    {
+        GLsizei length{ 0 };
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(m_ProgramID, i, max_length, &length, &size, &type, &name[0]);
+
+        // Arrays are reported as name[0]
+        std::string_view view{ name.data(), static_cast<size_t>(length) };
+        view = view.substr(0, view.find('['));
+
+        m_Uniforms.push_back(
+            { std::string{ view }, glGetUniformLocation(m_ProgramID, name.c_str()), type });
+    }
+
+    // Reported here once instead of whenever the transition is set up
+    m_DeclaredLocations.clear();
+    for (const auto& u : m_DeclaredUniforms)
+        m_DeclaredLocations.push_back(find_uniform(u.name, get_types(u.kind), false));
 }
 
-void Shader::set_4f(std::string_view name, const std::array<float, 4>& v) const
+int Shader::find_uniform(std::string_view name,
+                         std::initializer_list<GLenum> types,
+                         bool optional) const
 {
-    GLint loc{ glGetUniformLocation(m_ProgramID, name.data()) };
-    glUniform4f(loc, v[0], v[1], v[2], v[3]);
+    auto it{ std::find_if(m_Uniforms.begin(), m_Uniforms.end(), [&](const UniformInfo& u) {
+        return u.name == name;
+    }) };
+
+    bool found{ it != m_Uniforms.end() };
+    bool type_ok{ found && std::find(types.begin(), types.end(), it->type) != types.end() };
+
+    if (type_ok)
+        return it->location;
+
+    if ((found || !optional) &&
+        std::find(m_Reported.begin(), m_Reported.end(), name) == m_Reported.end())
+    {
+        m_Reported.emplace_back(name);
+
+        if (found)
+            spdlog::warn(fmt::format("Uniform '{}' of program {} has an unexpected type 0x{:x}",
+                                     name,
+                                     m_ProgramID,
+                                     it->type));
+        else
+            spdlog::warn(fmt::format("Program {} has no active uniform '{}'", m_ProgramID, name));
+    }
+
+    return -1;
 }
@@ -1,23 +1,132 @@
 #pragma once
 
+#include <GL/gl.h>
 #include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "transitions.hh"
+
+class ProgramCache;
+
+// Location of a uniform resolved once against a program's reflection table, T is the type
+// it is set with
+template<typename T>
+struct Uniform
+{
+    int location{ -1 };
+};
+
+// GL types a uniform can have to be set with T
+template<typename T>
+struct UniformTypes;
+template<>
+struct UniformTypes<int>
+{
+    static constexpr std::initializer_list<GLenum> types{ GL_INT, GL_BOOL, GL_SAMPLER_2D };
+};
+template<>
+struct UniformTypes<float>
+{
+    static constexpr std::initializer_list<GLenum> types{ GL_FLOAT };
+};
+template<>
+struct UniformTypes<std::array<float, 2>>
+{
+    static constexpr std::initializer_list<GLenum> types{ GL_FLOAT_VEC2 };
+};
+template<>
+struct UniformTypes<std::array<float, 3>>
+{
+    static constexpr std::initializer_list<GLenum> types{ GL_FLOAT_VEC3 };
+};
+template<>
+struct UniformTypes<std::array<float, 4>>
+{
+    static constexpr std::initializer_list<GLenum> types{ GL_FLOAT_VEC4 };
+};
 
 class Shader
 {
 public:
-    Shader(const std::string& vert, const std::string& frag);
+    // Starts compiling and linking a program from vert and frag, or loads it from cache when
+    // it holds a binary for them. finish() must be called before the program is used.
+    // uniforms are the ones declared by the transition in frag, they are resolved once the
+    // program is linked, see get_declared().
+    Shader(const std::string& vert,
+           const std::string& frag,
+           const ProgramCache* cache                   = nullptr,
+           std::span<const TransitionUniform> uniforms = {});
     ~Shader();
 
+    // Whether the driver is done compiling and finish() won't block, only meaningful with
+    // KHR_parallel_shader_compile
+    bool is_ready() const;
+    // Checks the result of the link, get_id() returns 0 if it failed
+    void finish();
+    bool is_finished() const { return m_Finished; }
+
     unsigned int get_id() const { return m_ProgramID; }
 
-    void set_1i(std::string_view name, int value) const;
+    // Looks name up in the table of active uniforms. Names that don't exist or have the wrong
+    // type are reported once, unless optional is set (e.g. uniforms the compiler may have
+    // optimized out), and give a handle that is ignored when set.
+    template<typename T>
+    Uniform<T> get_uniform(std::string_view name, bool optional = false) const
+    {
+        return { find_uniform(name, UniformTypes<T>::types, optional) };
+    }
+
+    // Handle of the declared uniform at index, resolved at link time. Missing ones were
+    // reported then and give a handle that is ignored when set.
+    template<typename T>
+    Uniform<T> get_declared(size_t index) const
+    {
+        return { index < m_DeclaredLocations.size() ? m_DeclaredLocations[index] : -1 };
+    }
 
-    void set_1f(std::string_view name, float value) const;
-    void set_2f(std::string_view name, const std::array<float, 2>& v) const;
-    // void set_3f(std::string_view name, std::array<float, 3>& v) const;
-    void set_4f(std::string_view name, const std::array<float, 4>& v) const;
+    // The program must be in use
+    void set(Uniform<int> u, int value) const { glUniform1i(u.location, value); }
+    void set(Uniform<float> u, float value) const { glUniform1f(u.location, value); }
+    void set(Uniform<std::array<float, 2>> u, const std::array<float, 2>& v) const
+    {
+        glUniform2f(u.location, v[0], v[1]);
+    }
+    void set(Uniform<std::array<float, 3>> u, const std::array<float, 3>& v) const
+    {
+        glUniform3f(u.location, v[0], v[1], v[2]);
+    }
+    void set(Uniform<std::array<float, 4>> u, const std::array<float, 4>& v) const
+    {
+        glUniform4f(u.location, v[0], v[1], v[2], v[3]);
+    }
 
 private:
-    unsigned int m_ProgramID;
+    struct UniformInfo
+    {
+        std::string name;
+        int location;
+        GLenum type;
+    };
+
+    // Fills m_Uniforms from the linked program and resolves the declared uniforms
+    void reflect();
+    int find_uniform(std::string_view name,
+                     std::initializer_list<GLenum> types,
+                     bool optional) const;
+
+    unsigned int m_ProgramID, m_VertID{ 0 }, m_FragID{ 0 };
+    const ProgramCache* m_Cache;
+    std::optional<uint64_t> m_CacheKey;
+    bool m_Finished{ false };
+
+    std::vector<UniformInfo> m_Uniforms;
+    mutable std::vector<std::string> m_Reported;
+    std::span<const TransitionUniform> m_DeclaredUniforms;
+    std::vector<int> m_DeclaredLocations;
 };
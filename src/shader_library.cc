@@ -0,0 +1,277 @@
+#include "shader_library.hh"
+
+#include "glutil.hh"
+#include "shader.hh"
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <array>
+#include <spdlog/spdlog.h>
+
+ShaderLibrary::ShaderLibrary(Display* display,
+                             GLXFBConfig fb_config,
+                             GLXContext context,
+                             const int* ctx_attribs,
+                             const ProgramCache* cache)
+    : m_Cache{ cache },
+      m_ParallelCompile{ gl_has_extension("GL_KHR_parallel_shader_compile") ||
+                         gl_has_extension("GL_ARB_parallel_shader_compile") },
+      m_Display{ display }
+{
+    if (m_ParallelCompile)
+    {
+        // Let the driver use as many threads as it wants
+        if (gl_has_extension("GL_KHR_parallel_shader_compile"))
+            glMaxShaderCompilerThreadsKHR(0xffffffff);
+        else
+            glMaxShaderCompilerThreadsARB(0xffffffff);
+
+        // Only produces the sources, it doesn't need a context
+        m_Thread = std::thread{ &ShaderLibrary::worker, this };
+    }
+    else
+    {
+        m_WorkerContext =
+            glXCreateContextAttribsARB(display, fb_config, context, true, ctx_attribs);
+
+        if (m_WorkerContext)
+            m_Thread = std::thread{ &ShaderLibrary::worker, this };
+        else
+            spdlog::warn("Failed to create a shared context, transitions are compiled on demand");
+    }
+
+    // 1x1 render target for the warm-up draws
+    glGenTextures(1, &m_WarmTexture);
+    glBindTexture(GL_TEXTURE_2D, m_WarmTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &m_WarmFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_WarmFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_WarmTexture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+ShaderLibrary::~ShaderLibrary()
+{
+    if (m_Thread.joinable())
+    {
+        {
+            std::lock_guard lock{ m_Mutex };
+            m_Stop = true;
+        }
+        m_CV.notify_all();
+        m_Thread.join();
+    }
+
+    if (m_WorkerContext)
+        glXDestroyContext(m_Display, m_WorkerContext);
+
+    glDeleteFramebuffers(1, &m_WarmFramebuffer);
+    glDeleteTextures(1, &m_WarmTexture);
+}
+
+void ShaderLibrary::precompile(const std::string& name,
+                               std::string vert,
+                               SourceFn frag,
+                               std::span<const TransitionUniform> uniforms)
+{
+    if (!m_Thread.joinable())
+        return;
+
+    if (contains(name))
+        return;
+
+    m_Queued.insert(name);
+
+    {
+        std::lock_guard lock{ m_Mutex };
+        m_Jobs.push_back({ name, std::move(vert), std::move(frag), uniforms });
+    }
+    m_CV.notify_one();
+}
+
+void ShaderLibrary::poll()
+{
+    if (m_ParallelCompile)
+    {
+        for (auto it{ m_Building.begin() }; it != m_Building.end();)
+        {
+            if (!it->second->is_ready())
+            {
+                ++it;
+                continue;
+            }
+
+            it->second->finish();
+            warm_up(*it->second);
+            m_Ready.insert(m_Building.extract(it++));
+        }
+
+        // Keep the driver's compiler threads busy without flooding them
+        std::lock_guard lock{ m_Mutex };
+        while (m_Building.size() < max_in_flight && !m_Sources.empty())
+        {
+            auto source{ std::move(m_Sources.front()) };
+            m_Sources.pop_front();
+
+            // Dropped by clear() or built by get() in the meantime
+            if (m_Queued.erase(source.name) == 0 || source.frag.empty() ||
+                m_Ready.contains(source.name) || m_Building.contains(source.name))
+                continue;
+
+            m_Building.emplace(
+                source.name,
+                std::make_unique<Shader>(source.vert, source.frag, m_Cache, source.uniforms));
+        }
+
+        return;
+    }
+
+    decltype(m_Finished) finished;
+    {
+        std::lock_guard lock{ m_Mutex };
+        finished.swap(m_Finished);
+    }
+
+    for (auto& [name, shader] : finished)
+    {
+        // Dropped by clear() or built by get() in the meantime
+        if (m_Queued.erase(name) == 0 || !shader || m_Ready.contains(name))
+            continue;
+
+        warm_up(*shader);
+        m_Ready.emplace(std::move(name), std::move(shader));
+    }
+}
+
+bool ShaderLibrary::contains(std::string_view name) const
+{
+    return m_Ready.contains(name) || m_Building.contains(name) || m_Queued.contains(name);
+}
+
+Shader* ShaderLibrary::find(const std::string& name)
+{
+    if (auto it{ m_Ready.find(name) }; it != m_Ready.end())
+        return it->second.get();
+
+    if (auto it{ m_Building.find(name) }; it != m_Building.end())
+    {
+        it->second->finish();
+        return m_Ready.insert(m_Building.extract(it)).position->second.get();
+    }
+
+    return nullptr;
+}
+
+Shader* ShaderLibrary::get(const std::string& name,
+                           const std::string& vert,
+                           const std::string& frag,
+                           std::span<const TransitionUniform> uniforms)
+{
+    if (auto* shader{ find(name) })
+        return shader;
+
+    // Not built yet, do it now and make sure the background doesn't do it again. A job the
+    // worker already took is dropped by poll() when it finishes.
+    {
+        std::lock_guard lock{ m_Mutex };
+        auto erased{ std::erase_if(m_Jobs, [&](const Job& job) { return job.name == name; }) +
+                     std::erase_if(m_Sources, [&](const Source& s) { return s.name == name; }) };
+        if (erased > 0)
+            m_Queued.erase(name);
+    }
+
+    auto shader{ std::make_unique<Shader>(vert, frag, m_Cache, uniforms) };
+    shader->finish();
+
+    return m_Ready.emplace(name, std::move(shader)).first->second.get();
+}
+
+void ShaderLibrary::clear(std::string_view keep)
+{
+    std::erase_if(m_Ready, [&](const auto& p) { return p.first != keep; });
+    std::erase_if(m_Building, [&](const auto& p) { return p.first != keep; });
+    std::erase_if(m_Queued, [&](const auto& name) { return name != keep; });
+
+    // Whatever the worker is busy with is dropped by poll() once it is done
+    std::lock_guard lock{ m_Mutex };
+    std::erase_if(m_Jobs, [&](const Job& job) { return job.name != keep; });
+    std::erase_if(m_Sources, [&](const Source& source) { return source.name != keep; });
+}
+
+void ShaderLibrary::worker()
+{
+    if (m_WorkerContext)
+        glXMakeCurrent(m_Display, None, m_WorkerContext);
+
+    while (true)
+    {
+        Job job;
+
+        {
+            std::unique_lock lock{ m_Mutex };
+            m_CV.wait(lock, [&]() { return m_Stop || !m_Jobs.empty(); });
+
+            if (m_Stop)
+                break;
+
+            job = std::move(m_Jobs.front());
+            m_Jobs.pop_front();
+        }
+
+        auto frag{ job.frag() };
+
+        // The driver builds it, poll() hands it over
+        if (m_ParallelCompile)
+        {
+            std::lock_guard lock{ m_Mutex };
+            m_Sources.push_back(
+                { std::move(job.name), std::move(job.vert), std::move(frag), job.uniforms });
+            continue;
+        }
+
+        std::unique_ptr<Shader> shader;
+        if (!frag.empty())
+        {
+            shader = std::make_unique<Shader>(job.vert, frag, m_Cache, job.uniforms);
+            shader->finish();
+            // The render context only sees the finished program after this
+            glFinish();
+        }
+
+        std::lock_guard lock{ m_Mutex };
+        m_Finished.emplace_back(std::move(job.name), std::move(shader));
+    }
+
+    if (m_WorkerContext)
+        glXMakeCurrent(m_Display, None, nullptr);
+}
+
+void ShaderLibrary::warm_up(const Shader& shader)
+{
+    if (shader.get_id() == 0)
+        return;
+
+    GLint vao{ 0 };
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+    if (vao == 0)
+        return;
+
+    GLint program, framebuffer;
+    std::array<GLint, 4> viewport;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport.data());
+
+    // Drivers tend to finish compiling lazily on the first draw, get that out of the way
+    // before the program shows up on screen
+    glBindFramebuffer(GL_FRAMEBUFFER, m_WarmFramebuffer);
+    glViewport(0, 0, 1, 1);
+    glUseProgram(shader.get_id());
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    glUseProgram(program);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <GL/glx.h>
+#include <X11/Xlib.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class ProgramCache;
+class Shader;
+struct TransitionUniform;
+
+// Builds transition programs ahead of time so switching transitions never compiles on the
+// render thread. Uses KHR_parallel_shader_compile when the driver has it, otherwise programs
+// are built by a worker thread on a context that shares objects with the render context.
+// Fragment sources are produced on the worker thread either way. Every finished program is
+// warmed up with one off-screen draw.
+class ShaderLibrary
+{
+public:
+    // Must be created on the render thread while context is current, ctx_attribs are used
+    // to create the worker's shared context
+    ShaderLibrary(Display* display,
+                  GLXFBConfig fb_config,
+                  GLXContext context,
+                  const int* ctx_attribs,
+                  const ProgramCache* cache);
+    ~ShaderLibrary();
+
+    // Returns the fragment source of a queued program, called on the worker thread. An empty
+    // source drops the program.
+    using SourceFn = std::function<std::string()>;
+
+    // Queues a program to be built in the background, does nothing if it already exists.
+    // uniforms are resolved once it is linked, see Shader::get_declared().
+    void precompile(const std::string& name,
+                    std::string vert,
+                    SourceFn frag,
+                    std::span<const TransitionUniform> uniforms = {});
+    // Picks up programs that have finished building, needs a vertex array bound for the
+    // warm-up draw
+    void poll();
+    // Whether programs are still being built and poll() has work left to pick up
+    bool is_busy() const { return !m_Queued.empty() || !m_Building.empty(); }
+    // Whether name is built, being built or queued, so its sources aren't needed again
+    bool contains(std::string_view name) const;
+    // Returns the program for name if it is built or being built, waiting for the driver to
+    // finish it, null if it hasn't been started
+    Shader* find(const std::string& name);
+    // Returns the program for name, building it right away if it isn't ready yet. The
+    // program has an id of 0 if it failed to build.
+    Shader* get(const std::string& name,
+                const std::string& vert,
+                const std::string& frag,
+                std::span<const TransitionUniform> uniforms = {});
+    // Deletes every program but keep and drops the queued ones, invalidating the pointers
+    // returned by get()
+    void clear(std::string_view keep = {});
+
+private:
+    // Number of programs handed to the driver's compiler threads at once
+    static constexpr size_t max_in_flight{ 4 };
+
+    struct Job
+    {
+        std::string name, vert;
+        SourceFn frag;
+        std::span<const TransitionUniform> uniforms;
+    };
+
+    // A job whose fragment source was produced, only used with parallel compile
+    struct Source
+    {
+        std::string name, vert, frag;
+        std::span<const TransitionUniform> uniforms;
+    };
+
+    void worker();
+    void warm_up(const Shader& shader);
+
+    const ProgramCache* m_Cache;
+    bool m_ParallelCompile;
+
+    std::map<std::string, std::unique_ptr<Shader>, std::less<>> m_Ready;
+    // Programs the driver is building, only used with parallel compile
+    std::map<std::string, std::unique_ptr<Shader>, std::less<>> m_Building;
+    // Render thread only, names that were queued and not picked up yet
+    std::set<std::string, std::less<>> m_Queued;
+
+    Display* m_Display;
+    GLXContext m_WorkerContext{ nullptr };
+    std::thread m_Thread;
+    std::mutex m_Mutex;
+    std::condition_variable m_CV;
+    std::deque<Job> m_Jobs;
+    std::deque<Source> m_Sources;
+    std::vector<std::pair<std::string, std::unique_ptr<Shader>>> m_Finished;
+    bool m_Stop{ false };
+
+    unsigned int m_WarmFramebuffer{ 0 }, m_WarmTexture{ 0 };
+};
@@ -0,0 +1,264 @@
+#include "strip_decoder.hh"
+
+#include "resize.hh"
+
+#include <csetjmp>
+#include <cstdio>
+#include <spdlog/spdlog.h>
+
+#ifdef HAVE_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
+
+// libjpeg and libpng report errors by longjmp'ing out of the library, every function calling
+// into them sets the jump target first and only keeps trivially destructible locals
+
+namespace
+{
+#ifdef HAVE_LIBJPEG
+    class JpegStripDecoder : public StripDecoder
+    {
+    public:
+        JpegStripDecoder() = default;
+        ~JpegStripDecoder() override
+        {
+            if (m_Created)
+                jpeg_destroy_decompress(&m_Info);
+            if (m_File)
+                fclose(m_File);
+        }
+
+        bool open(const std::string& path, int target_w, int target_h, size_t memory_limit)
+        {
+            m_File = fopen(path.c_str(), "rb");
+            if (!m_File)
+                return false;
+
+            m_Info.err                     = jpeg_std_error(&m_JpegError.mgr);
+            m_JpegError.mgr.error_exit     = error_exit;
+            m_JpegError.mgr.output_message = output_message;
+
+            if (setjmp(m_JpegError.jump))
+            {
+                m_Error = m_JpegError.message;
+                return false;
+            }
+
+            jpeg_create_decompress(&m_Info);
+            m_Created = true;
+            m_Info.mem->max_memory_to_use = static_cast<long>(memory_limit);
+
+            jpeg_stdio_src(&m_Info, m_File);
+            jpeg_read_header(&m_Info, TRUE);
+
+            // CMYK and YCCK can't be converted to RGB by libjpeg
+            if (m_Info.jpeg_color_space != JCS_GRAYSCALE && m_Info.jpeg_color_space != JCS_YCbCr &&
+                m_Info.jpeg_color_space != JCS_RGB)
+                return false;
+
+            m_Info.out_color_space = JCS_RGB;
+
+            // Scaling in the IDCT is nearly free, use the smallest scale that still covers the
+            // screen at the same size
+            auto cover{ get_cover_size(
+                m_Info.image_width, m_Info.image_height, target_w, target_h) };
+
+            for (unsigned int denom : { 8u, 4u, 2u })
+            {
+                m_Info.scale_num   = 1;
+                m_Info.scale_denom = denom;
+                jpeg_calc_output_dimensions(&m_Info);
+
+                if (get_cover_size(m_Info.output_width, m_Info.output_height, target_w, target_h) ==
+                    cover)
+                    break;
+
+                m_Info.scale_denom = 1;
+            }
+
+            jpeg_start_decompress(&m_Info);
+
+            m_Width  = static_cast<int>(m_Info.output_width);
+            m_Height = static_cast<int>(m_Info.output_height);
+
+            return true;
+        }
+
+        int read_rows(unsigned char* rows, size_t stride, int n_rows) override
+        {
+            // Volatile so the count survives the longjmp
+            volatile int n{ 0 };
+
+            if (setjmp(m_JpegError.jump))
+            {
+                m_Error = m_JpegError.message;
+                return 0;
+            }
+
+            while (n < n_rows && m_Info.output_scanline < m_Info.output_height)
+            {
+                JSAMPROW row{ rows + n * stride };
+                n = n + static_cast<int>(jpeg_read_scanlines(&m_Info, &row, 1));
+            }
+
+            return n;
+        }
+
+    private:
+        struct Error
+        {
+            jpeg_error_mgr mgr;
+            jmp_buf jump;
+            char message[JMSG_LENGTH_MAX];
+        };
+
+        static void error_exit(j_common_ptr info)
+        {
+            auto* error{ reinterpret_cast<Error*>(info->err) };
+            info->err->format_message(info, error->message);
+            longjmp(error->jump, 1);
+        }
+
+        // Warnings about corrupt data, libjpeg would print them to stderr
+        static void output_message(j_common_ptr info)
+        {
+            char message[JMSG_LENGTH_MAX];
+            info->err->format_message(info, message);
+            spdlog::debug(fmt::format("libjpeg: {}", message));
+        }
+
+        FILE* m_File{ nullptr };
+        jpeg_decompress_struct m_Info;
+        Error m_JpegError;
+        bool m_Created{ false };
+    };
+#endif
+
+#ifdef HAVE_LIBPNG
+    class PngStripDecoder : public StripDecoder
+    {
+    public:
+        PngStripDecoder() = default;
+        ~PngStripDecoder() override
+        {
+            if (m_Png)
+                png_destroy_read_struct(&m_Png, m_Info ? &m_Info : nullptr, nullptr);
+            if (m_File)
+                fclose(m_File);
+        }
+
+        bool open(const std::string& path)
+        {
+            m_File = fopen(path.c_str(), "rb");
+            if (!m_File)
+                return false;
+
+            m_Png = png_create_read_struct(PNG_LIBPNG_VER_STRING, m_Message, error, warning);
+            if (!m_Png)
+                return false;
+
+            m_Info = png_create_info_struct(m_Png);
+            if (!m_Info)
+                return false;
+
+            if (setjmp(png_jmpbuf(m_Png)))
+            {
+                m_Error = m_Message;
+                return false;
+            }
+
+            png_init_io(m_Png, m_File);
+            png_read_info(m_Png, m_Info);
+
+            // Interlaced images only have their first rows after the last pass
+            if (png_get_interlace_type(m_Png, m_Info) != PNG_INTERLACE_NONE)
+                return false;
+
+            // Same conversions as stb_image: 8 bits per channel, alpha dropped, no gamma
+            png_set_expand(m_Png);
+            png_set_strip_16(m_Png);
+            png_set_strip_alpha(m_Png);
+            png_set_gray_to_rgb(m_Png);
+            png_read_update_info(m_Png, m_Info);
+
+            m_Width  = static_cast<int>(png_get_image_width(m_Png, m_Info));
+            m_Height = static_cast<int>(png_get_image_height(m_Png, m_Info));
+
+            return png_get_rowbytes(m_Png, m_Info) == static_cast<size_t>(m_Width) * 3;
+        }
+
+        int read_rows(unsigned char* rows, size_t stride, int n_rows) override
+        {
+            volatile int n{ 0 };
+
+            if (setjmp(png_jmpbuf(m_Png)))
+            {
+                m_Error = m_Message;
+                return 0;
+            }
+
+            for (; n < n_rows && m_Row < m_Height; n = n + 1, ++m_Row)
+                png_read_row(m_Png, rows + n * stride, nullptr);
+
+            return n;
+        }
+
+    private:
+        static void error(png_structp png, png_const_charp message)
+        {
+            snprintf(static_cast<char*>(png_get_error_ptr(png)), message_size, "%s", message);
+            png_longjmp(png, 1);
+        }
+
+        static void warning(png_structp, png_const_charp message)
+        {
+            spdlog::debug(fmt::format("libpng: {}", message));
+        }
+
+        static constexpr size_t message_size{ 256 };
+
+        FILE* m_File{ nullptr };
+        png_structp m_Png{ nullptr };
+        png_infop m_Info{ nullptr };
+        int m_Row{ 0 };
+        char m_Message[message_size]{};
+    };
+#endif
+}
+
+std::unique_ptr<StripDecoder> StripDecoder::open(const std::string& path,
+                                                 [[maybe_unused]] ImageFormat format,
+                                                 [[maybe_unused]] int target_w,
+                                                 [[maybe_unused]] int target_h,
+                                                 [[maybe_unused]] size_t memory_limit)
+{
+#ifdef HAVE_LIBJPEG
+    if (format == ImageFormat::Jpeg)
+    {
+        auto decoder{ std::make_unique<JpegStripDecoder>() };
+        if (decoder->open(path, target_w, target_h, memory_limit))
+            return decoder;
+
+        if (!decoder->get_error().empty())
+            spdlog::debug(fmt::format("Can't stream {}: {}", path, decoder->get_error()));
+    }
+#endif
+
+#ifdef HAVE_LIBPNG
+    if (format == ImageFormat::Png)
+    {
+        auto decoder{ std::make_unique<PngStripDecoder>() };
+        if (decoder->open(path))
+            return decoder;
+
+        if (!decoder->get_error().empty())
+            spdlog::debug(fmt::format("Can't stream {}: {}", path, decoder->get_error()));
+    }
+#endif
+
+    return nullptr;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "image_sniffer.hh"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Decodes an image a few rows at a time, top to bottom, for images too big to be decoded whole.
+// Only baseline and progressive JPEGs (libjpeg) and non-interlaced PNGs (libpng) can be read
+// like this, and only when glpaper was built with those libraries. Output is RGB like
+// stbi_load(path, ..., 3) but never flipped.
+class StripDecoder
+{
+public:
+    virtual ~StripDecoder() = default;
+
+    // Opens path for decoding, null if its format can't be streamed or it fails to open. JPEGs
+    // that will be scaled down to target_w x target_h anyway may be decoded at a half, quarter
+    // or eighth of their size. A progressive JPEG has to be buffered whole in the decoder, it
+    // fails if that takes more than memory_limit bytes.
+    static std::unique_ptr<StripDecoder> open(const std::string& path,
+                                              ImageFormat format,
+                                              int target_w,
+                                              int target_h,
+                                              size_t memory_limit);
+
+    // Size of the decoded image
+    int get_width() const { return m_Width; }
+    int get_height() const { return m_Height; }
+
+    // Decodes the next rows into rows, returns how many were decoded, up to n_rows. 0 means an
+    // error or that all rows have been read.
+    virtual int read_rows(unsigned char* rows, size_t stride, int n_rows) = 0;
+    // Why the last call failed
+    const std::string& get_error() const { return m_Error; }
+
+protected:
+    int m_Width{ 0 }, m_Height{ 0 };
+    std::string m_Error;
+};
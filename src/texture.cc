@@ -1,56 +1,60 @@
 #include "texture.hh"
 
-#include <GL/gl.h>
-#include <fmt/core.h>
-#include <stdexcept>
-#include <utility>
+#include "image.hh"
+#include "texture_pool.hh"
+#include "upload.hh"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb/stb_image.h>
+#include <GL/gl.h>
 
-Texture::Texture(std::string path) : m_Path{ std::move(path) }
+Texture::Texture(const Image& img, UploadRing* upload_ring)
+    : m_Path{ PathStore::get().add(img.path) },
+      m_TexID{ TexturePool::get().acquire(img.width, img.height) },
+      m_Width{ img.width },
+      m_Height{ img.height }
 {
-    stbi_set_flip_vertically_on_load(true);
-    auto* pixel_data{ stbi_load(m_Path.c_str(), &m_Width, &m_Height, nullptr, 3) };
+    bind(0);
 
-    if (!pixel_data)
-        throw std::runtime_error(fmt::format("Failed to load image {}", m_Path));
+    bool from_slot{ upload_ring && img.upload_slot >= 0 };
+    if (from_slot)
+        upload_ring->bind(img.upload_slot);
 
-    glGenTextures(1, &m_TexID);
-    bind(0);
+    // Rows are either tightly packed or padded to 4 bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, img.stride % 4 == 0 ? 4 : 1);
+    glTexSubImage2D(GL_TEXTURE_2D,
+                    0,
+                    0,
+                    0,
+                    m_Width,
+                    m_Height,
+                    GL_RGB,
+                    GL_UNSIGNED_BYTE,
+                    from_slot ? nullptr : img.pixels.get());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    if (from_slot)
+        upload_ring->unbind_and_fence(img.upload_slot);
 
-    glTexImage2D(
-        GL_TEXTURE_2D, 0, GL_RGB8, m_Width, m_Height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixel_data);
     unbind();
-
-    stbi_image_free(pixel_data);
 }
 Texture::Texture(const std::array<float, 4>& color)
+    : m_TexID{ TexturePool::get().acquire(1, 1) },
+      m_Width{ 1 },
+      m_Height{ 1 }
 {
-    glGenTextures(1, &m_TexID);
     bind(0);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
     std::array<unsigned char, 3> pixel_data{ static_cast<unsigned char>(color[0] * 255),
                                              static_cast<unsigned char>(color[1] * 255),
                                              static_cast<unsigned char>(color[2] * 255) };
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, pixel_data.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, pixel_data.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     unbind();
 }
 
 Texture::~Texture()
 {
-    glDeleteTextures(1, &m_TexID);
-    glFinish();
+    TexturePool::get().release(m_TexID, m_Width, m_Height);
 }
 
 void Texture::bind(unsigned int slot) const
@@ -1,26 +1,34 @@
 #pragma once
 
+#include "path_store.hh"
+
 #include <array>
-#include <string>
+
+struct Image;
+class UploadRing;
 
 class Texture
 {
 public:
-    Texture(std::string path);
+    // Pixels in an upload ring slot are uploaded from the slot's buffer object
+    Texture(const Image& img, UploadRing* upload_ring = nullptr);
     Texture(const std::array<float, 4>& color);
     ~Texture();
 
     void bind(unsigned int slot) const;
     void unbind() const;
 
-    inline std::string_view get_path() const { return m_Path; }
+    // invalid_id for a solid color
+    inline PathStore::Id get_path() const { return m_Path; }
+    // After the path store is compacted
+    inline void set_path(PathStore::Id path) { m_Path = path; }
     inline int get_width() const { return m_Width; }
     inline int get_height() const { return m_Height; }
 
 private:
     Texture() = delete;
 
-    std::string m_Path;
+    PathStore::Id m_Path{ PathStore::invalid_id };
     unsigned int m_TexID;
 
     int m_Width, m_Height;
@@ -0,0 +1,101 @@
+#include "texture_pool.hh"
+
+#include "deletion_queue.hh"
+#include "glutil.hh"
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+TexturePool& TexturePool::get()
+{
+    static TexturePool pool;
+    return pool;
+}
+
+TexturePool::TexturePool()
+    : m_HasStorage{ gl_version_at_least(4, 2) || gl_has_extension("GL_ARB_texture_storage") }
+{
+}
+
+unsigned int TexturePool::acquire(int width, int height)
+{
+    for (auto it{ m_Free.begin() }; it != m_Free.end(); ++it)
+    {
+        if (it->width != width || it->height != height)
+            continue;
+
+        GLenum res{ glClientWaitSync(it->fence, 0, 0) };
+        if (res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED)
+            continue;
+
+        unsigned int id{ it->id };
+        glDeleteSync(it->fence);
+        m_Free.erase(it);
+        ++m_Hits;
+
+        return id;
+    }
+
+    ++m_Misses;
+    spdlog::debug(fmt::format(
+        "Allocating {}x{} texture (pool hits: {}, misses: {})", width, height, m_Hits, m_Misses));
+
+    GLuint id;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    if (m_HasStorage)
+    {
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB8, width, height);
+    }
+    else
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(
+            GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return id;
+}
+
+void TexturePool::release(unsigned int id, int width, int height)
+{
+    auto count{ std::count_if(m_Free.begin(), m_Free.end(), [&](const Entry& e) {
+        return e.width == width && e.height == height;
+    }) };
+
+    // Drop the oldest texture of this size instead of growing without bound
+    if (count >= max_free_per_size)
+    {
+        auto oldest{ std::find_if(m_Free.begin(), m_Free.end(), [&](const Entry& e) {
+            return e.width == width && e.height == height;
+        }) };
+
+        glDeleteSync(oldest->fence);
+        DeletionQueue::get().delete_texture(oldest->id);
+        m_Free.erase(oldest);
+    }
+
+    m_Free.push_back({ id, width, height, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) });
+    glFlush();
+}
+
+void TexturePool::trim()
+{
+    for (auto& e : m_Free)
+    {
+        glDeleteSync(e.fence);
+        DeletionQueue::get().delete_texture(e.id);
+    }
+
+    m_Free.clear();
+}
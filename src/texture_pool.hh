@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+typedef struct __GLsync* GLsync;
+
+// Recycles RGB8 textures of the same size.
+// Storage is allocated once with glTexStorage2D (when available) and refilled with
+// glTexSubImage2D, a released texture is only handed out again after the GPU has finished
+// the commands that were issued before it was released. Only used from the render thread.
+class TexturePool
+{
+public:
+    static TexturePool& get();
+
+    // Returns a texture with storage for a width x height image
+    unsigned int acquire(int width, int height);
+    void release(unsigned int id, int width, int height);
+    // Deletes every free texture
+    void trim();
+
+    uint64_t get_hits() const { return m_Hits; }
+    uint64_t get_misses() const { return m_Misses; }
+
+private:
+    TexturePool();
+
+    // Free textures kept around per size
+    static constexpr int max_free_per_size{ 2 };
+
+    struct Entry
+    {
+        unsigned int id;
+        int width, height;
+        GLsync fence;
+    };
+
+    std::vector<Entry> m_Free;
+    bool m_HasStorage;
+    uint64_t m_Hits{ 0 }, m_Misses{ 0 };
+};
@@ -0,0 +1,74 @@
+#include "transition_source.hh"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+#include <zlib.h>
+
+TransitionSourceCache::TransitionSourceCache(size_t capacity)
+    : m_Capacity{ std::max(capacity, size_t{ 1 }) }
+{
+}
+
+std::shared_ptr<const std::string> TransitionSourceCache::get(const TransitionEntry& entry)
+{
+    const auto& [name, info]{ entry };
+
+    for (auto it{ m_Sources.begin() }; it != m_Sources.end(); ++it)
+    {
+        if (it->first == name)
+        {
+            m_Sources.splice(m_Sources.begin(), m_Sources, it);
+            return it->second;
+        }
+    }
+
+    auto source{ inflate(entry) };
+    if (!source)
+        return nullptr;
+
+    if (m_Sources.size() >= m_Capacity)
+        m_Sources.pop_back();
+    m_Sources.emplace_front(name, std::make_shared<const std::string>(std::move(*source)));
+
+    return m_Sources.front().second;
+}
+
+std::optional<std::string> TransitionSourceCache::inflate(const TransitionEntry& entry)
+{
+    const auto& [name, info]{ entry };
+
+    auto blob{ transitions_map.get_blob() };
+    if (size_t{ info.offset } + info.compressed_size > blob.size())
+    {
+        spdlog::error(fmt::format("Embedded source of transition '{}' is out of range", name));
+        return std::nullopt;
+    }
+
+    std::string source(info.size, '\0');
+    z_stream stream{};
+
+    // Raw deflate, each source was flushed independently by tools/embed.cc
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+    {
+        spdlog::error("Failed to initialize zlib");
+        return std::nullopt;
+    }
+
+    stream.next_in   = const_cast<unsigned char*>(blob.data() + info.offset);
+    stream.avail_in  = info.compressed_size;
+    stream.next_out  = reinterpret_cast<unsigned char*>(source.data());
+    stream.avail_out = info.size;
+
+    auto ret{ ::inflate(&stream, Z_SYNC_FLUSH) };
+    auto inflated{ stream.total_out };
+    inflateEnd(&stream);
+
+    if ((ret != Z_OK && ret != Z_STREAM_END) || inflated != info.size)
+    {
+        spdlog::error(fmt::format("Failed to inflate the source of transition '{}'", name));
+        return std::nullopt;
+    }
+
+    return source;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "transitions.hh"
+
+// Inflates embedded transition sources on demand and keeps the few most recently used ones,
+// so only the transitions that are actually shown are ever resident.
+class TransitionSourceCache
+{
+public:
+    TransitionSourceCache(size_t capacity);
+
+    // Returns the null-terminated source of entry, or nullptr if it could not be inflated
+    std::shared_ptr<const std::string> get(const TransitionEntry& entry);
+    // Inflates the source of entry without caching it, safe to call from any thread
+    static std::optional<std::string> inflate(const TransitionEntry& entry);
+
+private:
+    size_t m_Capacity;
+    // Most recently used first
+    std::list<std::pair<std::string_view, std::shared_ptr<const std::string>>> m_Sources;
+};
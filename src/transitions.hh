@@ -1,6 +1,107 @@
 #pragma once
 
-#include <map>
-#include <string>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <utility>
 
-extern std::map<std::string_view, const unsigned char*> transitions_map;
+#include "hash.hh"
+
+// Type of a uniform as declared in the transition's source
+enum class UniformKind : uint8_t
+{
+    Int,
+    Float,
+    Vec2,
+    Vec3,
+    Vec4,
+};
+
+// Modifiers that follow the default value in a uniform's annotation, ie.
+//   uniform vec2 size; // = vec2(4.0, 4.0) ratio
+//   uniform vec2 direction; // = vec2(0.0, 1.0) random(-1.0, 1.0)
+enum UniformFlags : uint8_t
+{
+    // Each component is picked between min and max whenever the transition is set up
+    UniformRandom = 1 << 0,
+    // The x component is multiplied by the screen's aspect ratio
+    UniformRatio = 1 << 1,
+    // Every component is divided by the screen's aspect ratio
+    UniformInvRatio = 1 << 2,
+    // Set to the configured background color
+    UniformBGColor = 1 << 3,
+};
+
+struct TransitionUniform
+{
+    std::string_view name;
+    UniformKind kind;
+    std::array<float, 4> value, min, max;
+    uint8_t flags;
+};
+
+struct TransitionInfo
+{
+    // Location of the source in the table's compressed blob, each source starts at a
+    // deflate full flush point so it can be inflated on its own
+    uint32_t offset, compressed_size, size;
+    std::span<const TransitionUniform> uniforms;
+};
+
+using TransitionEntry = std::pair<std::string_view, TransitionInfo>;
+
+// Read-only table of the embedded transitions, iterated in name order. The sources are kept
+// deflated in a single blob, see TransitionSourceCache. Lookups go through a
+// two-level perfect hash computed by tools/embed.cc: the name's hash picks a bucket, the bucket's
+// seed rehashes it into a slot, and the slot holds the entry index, so a lookup compares at
+// most one name.
+class TransitionTable
+{
+public:
+    constexpr TransitionTable(std::span<const TransitionEntry> entries,
+                              std::span<const uint32_t> seeds,
+                              std::span<const uint16_t> slots,
+                              std::span<const unsigned char> blob)
+        : m_Entries{ entries },
+          m_Seeds{ seeds },
+          m_Slots{ slots },
+          m_Blob{ blob }
+    {
+    }
+
+    static constexpr size_t get_bucket(uint64_t hash, size_t n_buckets)
+    {
+        return hash % n_buckets;
+    }
+    static constexpr size_t get_slot(uint64_t hash, uint32_t seed, size_t n_slots)
+    {
+        return fnv1a_value(seed, hash) % n_slots;
+    }
+
+    constexpr const TransitionEntry* begin() const { return m_Entries.data(); }
+    constexpr const TransitionEntry* end() const { return m_Entries.data() + m_Entries.size(); }
+    constexpr size_t size() const { return m_Entries.size(); }
+    constexpr std::span<const unsigned char> get_blob() const { return m_Blob; }
+
+    constexpr const TransitionEntry* find(std::string_view name) const
+    {
+        if (m_Entries.empty())
+            return end();
+
+        auto hash{ fnv1a(name) };
+        auto seed{ m_Seeds[get_bucket(hash, m_Seeds.size())] };
+        const auto& entry{ m_Entries[m_Slots[get_slot(hash, seed, m_Slots.size())]] };
+
+        return entry.first == name ? &entry : end();
+    }
+
+private:
+    std::span<const TransitionEntry> m_Entries;
+    std::span<const uint32_t> m_Seeds;
+    std::span<const uint16_t> m_Slots;
+    std::span<const unsigned char> m_Blob;
+};
+
+// Generated by tools/embed.cc from transitions/*.glsl
+extern const TransitionTable transitions_map;
@@ -0,0 +1,119 @@
+#include "upload.hh"
+
+#include "deletion_queue.hh"
+#include "glutil.hh"
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <spdlog/spdlog.h>
+
+UploadRing::UploadRing(size_t n_slots, size_t slot_size) : m_SlotSize{ slot_size }
+{
+    if (!gl_version_at_least(4, 4) && !gl_has_extension("GL_ARB_buffer_storage"))
+    {
+        spdlog::info("ARB_buffer_storage is not supported, uploading from client memory");
+        return;
+    }
+
+    m_Slots = std::make_unique<SlotData[]>(n_slots);
+
+    // Readable so decoded images can be written to the disk cache straight from the slot,
+    // client storage keeps the mapping in cached system memory rather than write-combined
+    constexpr GLbitfield flags{ GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                                GL_MAP_COHERENT_BIT };
+
+    for (; m_SlotCount < n_slots; ++m_SlotCount)
+    {
+        auto& slot{ m_Slots[m_SlotCount] };
+
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        glBufferStorage(
+            GL_PIXEL_UNPACK_BUFFER, m_SlotSize, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+        slot.data = static_cast<unsigned char*>(
+            glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, m_SlotSize, flags));
+
+        if (!slot.data)
+        {
+            spdlog::warn("Failed to map pixel unpack buffer");
+            glDeleteBuffers(1, &slot.buffer);
+            break;
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+UploadRing::~UploadRing()
+{
+    for (size_t i = 0; i < m_SlotCount; ++i)
+    {
+        auto& slot{ m_Slots[i] };
+
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        DeletionQueue::get().delete_buffer(slot.buffer);
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+std::optional<UploadRing::Slot> UploadRing::acquire(size_t size)
+{
+    if (size > m_SlotSize)
+        return std::nullopt;
+
+    for (size_t i = 0; i < m_SlotCount; ++i)
+    {
+        int expected{ Free };
+        if (m_Slots[i].state.compare_exchange_strong(expected, Writing, std::memory_order_acquire))
+            return Slot{ static_cast<int>(i), m_Slots[i].data };
+    }
+
+    return std::nullopt;
+}
+
+void UploadRing::release(int index)
+{
+    // Slots that were uploaded from are recycled by collect() once their fence signals
+    int expected{ Writing };
+    m_Slots[index].state.compare_exchange_strong(expected, Free, std::memory_order_release);
+}
+
+void UploadRing::bind(int index) const
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_Slots[index].buffer);
+}
+
+void UploadRing::unbind_and_fence(int index)
+{
+    auto& slot{ m_Slots[index] };
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    slot.state.store(InFlight, std::memory_order_relaxed);
+}
+
+void UploadRing::collect()
+{
+    for (size_t i = 0; i < m_SlotCount; ++i)
+    {
+        auto& slot{ m_Slots[i] };
+
+        if (slot.state.load(std::memory_order_relaxed) != InFlight)
+            continue;
+
+        // Zero timeout, this only polls the fence
+        GLenum res{ glClientWaitSync(slot.fence, 0, 0) };
+        if (res == GL_ALREADY_SIGNALED || res == GL_CONDITION_SATISFIED)
+        {
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+            slot.state.store(Free, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+typedef struct __GLsync* GLsync;
+
+// Ring of persistently mapped pixel unpack buffers.
+// Decoder threads write pixels straight into a slot's mapped memory, the render thread then
+// uploads from the buffer object without the driver copying client memory. A fence tracks
+// when the GPU is done reading a slot so it can be handed out again.
+class UploadRing
+{
+public:
+    struct Slot
+    {
+        int index;
+        unsigned char* data;
+    };
+
+    // Must be created on the render thread, ends up with no slots if the context lacks
+    // ARB_buffer_storage
+    UploadRing(size_t n_slots, size_t slot_size);
+    ~UploadRing();
+
+    // Thread safe, returns nothing if all slots are busy or size is too big
+    std::optional<Slot> acquire(size_t size);
+    // Thread safe, returns a slot that was never uploaded from
+    void release(int index);
+
+    // Render thread only, binds the slot as GL_PIXEL_UNPACK_BUFFER
+    void bind(int index) const;
+    // Render thread only, unbinds the buffer and fences the slot after an upload was issued
+    void unbind_and_fence(int index);
+    // Render thread only, recycles slots whose uploads have completed
+    void collect();
+
+    size_t get_slot_count() const { return m_SlotCount; }
+
+private:
+    enum State
+    {
+        Free,
+        Writing,
+        InFlight,
+    };
+
+    struct SlotData
+    {
+        std::atomic<int> state{ Free };
+        unsigned int buffer{ 0 };
+        unsigned char* data{ nullptr };
+        GLsync fence{ nullptr };
+    };
+
+    size_t m_SlotCount{ 0 }, m_SlotSize;
+    std::unique_ptr<SlotData[]> m_Slots;
+};
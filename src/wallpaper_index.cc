@@ -0,0 +1,474 @@
+#include "wallpaper_index.hh"
+
+#include "file_prober.hh"
+#include "hash.hh"
+#include "work_stealing_pool.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <fnmatch.h>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace
+{
+    constexpr uint32_t index_magic{ 0x49504c47 }; // "GLPI"
+    constexpr uint32_t index_version{ 1 };
+    // Files sniffed again per task when their header didn't fit in what the prober read
+    constexpr size_t probe_batch_size{ 32 };
+
+    // Followed by count records and then the path strings the records point into
+    struct IndexHeader
+    {
+        uint32_t magic, version;
+        uint64_t count;
+        uint64_t strings_size;
+        uint8_t reserved[40];
+    };
+    static_assert(sizeof(IndexHeader) == 64);
+
+    struct IndexRecord
+    {
+        int64_t mtime_sec, mtime_nsec;
+        uint64_t size;
+        uint32_t path_offset, path_length;
+        int32_t width, height;
+        uint8_t format;
+        uint8_t reserved[7];
+    };
+    static_assert(sizeof(IndexRecord) == 48);
+
+    void set_image(WallpaperIndex::Entry& entry, const SniffResult& result)
+    {
+        entry.format = result.format;
+        entry.width  = result.width;
+        entry.height = result.height;
+    }
+}
+
+WallpaperIndex::WallpaperIndex(std::string directory)
+    : m_Directory{ std::move(directory) }
+{
+    std::error_code ec;
+    fs::create_directories(m_Directory, ec);
+
+    if (ec)
+        spdlog::warn(
+            fmt::format("Failed to create index directory {}: {}", m_Directory, ec.message()));
+}
+
+bool WallpaperIndex::ScanOptions::matches_file(const char* name) const
+{
+    auto matches{ [name](const std::string& pattern) {
+        return fnmatch(pattern.c_str(), name, 0) == 0;
+    } };
+
+    return (include.empty() || std::any_of(include.begin(), include.end(), matches)) &&
+           std::none_of(exclude.begin(), exclude.end(), matches);
+}
+
+bool WallpaperIndex::ScanOptions::matches_directory(const char* name) const
+{
+    return std::none_of(exclude.begin(), exclude.end(), [name](const std::string& pattern) {
+        return fnmatch(pattern.c_str(), name, 0) == 0;
+    });
+}
+
+WallpaperIndex::ScanResult WallpaperIndex::scan(const std::vector<std::string>& roots,
+                                                const ScanOptions& options) const
+{
+    struct Root
+    {
+        std::string index_path;
+        std::vector<Entry> old_entries, entries;
+        size_t n_probed{ 0 }, n_reused{ 0 };
+    };
+
+    auto start{ std::chrono::steady_clock::now() };
+    std::vector<Root> state(roots.size());
+    std::unordered_map<std::string_view, const Entry*> known;
+
+    for (size_t i = 0; i < roots.size(); ++i)
+    {
+        state[i].index_path  = get_index_path(roots[i]);
+        state[i].old_entries = read(state[i].index_path);
+
+        for (const auto& e : state[i].old_entries)
+            known.emplace(e.path, &e);
+    }
+
+    ScanResult result;
+    // Candidate files and the root each one was found in
+    std::vector<Entry> files;
+    std::vector<size_t> file_roots;
+    std::mutex mutex;
+    WorkStealingPool pool;
+
+    // The walk only reads directories, files are stat'd and probed in bulk afterwards
+    std::function<void(size_t, std::string)> scan_directory{ [&](size_t root, std::string dir) {
+        DIR* d{ opendir(dir.c_str()) };
+        if (!d)
+        {
+            spdlog::error(fmt::format("Failed to read {}: {}", dir, strerror(errno)));
+            return;
+        }
+
+        std::vector<std::string> paths;
+        auto prefix{ dir.ends_with('/') ? dir : dir + '/' };
+
+        while (const auto* de{ readdir(d) })
+        {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+                continue;
+
+            auto type{ de->d_type };
+
+            // Only some file systems fill in d_type
+            struct stat st;
+            if (type == DT_UNKNOWN &&
+                fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+
+            if (type == DT_DIR)
+            {
+                if (options.recursive && options.matches_directory(de->d_name))
+                    pool.push([&, root, path = prefix + de->d_name]() mutable {
+                        scan_directory(root, std::move(path));
+                    });
+            }
+            else if ((type == DT_REG || type == DT_LNK) && options.matches_file(de->d_name))
+            {
+                paths.push_back(prefix + de->d_name);
+            }
+        }
+
+        closedir(d);
+
+        std::scoped_lock lock{ mutex };
+        for (auto& path : paths)
+        {
+            files.push_back({ .path = std::move(path) });
+            file_roots.push_back(root);
+        }
+        result.directories.push_back(std::move(dir));
+    } };
+
+    for (size_t i = 0; i < roots.size(); ++i)
+        pool.push([&, i] { scan_directory(i, roots[i]); });
+
+    pool.run();
+
+    FileProber prober;
+    std::vector<const char*> paths;
+    paths.reserve(files.size());
+    for (const auto& e : files)
+        paths.push_back(e.path.c_str());
+
+    auto stats{ prober.stat(paths) };
+    std::vector<size_t> changed;
+    paths.clear();
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        // Gone, or a symlink to a directory
+        if (!stats[i].valid)
+            continue;
+
+        auto& entry{ files[i] };
+        entry.mtime_sec  = stats[i].mtime_sec;
+        entry.mtime_nsec = stats[i].mtime_nsec;
+        entry.size       = stats[i].size;
+
+        auto it{ known.find(entry.path) };
+        if (it != known.end() && it->second->mtime_sec == entry.mtime_sec &&
+            it->second->mtime_nsec == entry.mtime_nsec && it->second->size == entry.size)
+        {
+            state[file_roots[i]].entries.push_back(*it->second);
+            ++state[file_roots[i]].n_reused;
+        }
+        else
+        {
+            changed.push_back(i);
+            paths.push_back(entry.path.c_str());
+        }
+    }
+
+    std::vector<uint8_t> truncated(changed.size(), false);
+    prober.read_headers(paths, [&](size_t i, const unsigned char* data, size_t len) {
+        auto& entry{ files[changed[i]] };
+        auto result{ sniff_image(data, len) };
+
+        set_image(entry, result);
+        truncated[i] = result.truncated && entry.size > len;
+    });
+
+    // Headers that didn't fit in what was read, usually JPEGs with a lot of metadata
+    for (size_t first = 0; first < changed.size(); first += probe_batch_size)
+    {
+        pool.push([&, first] {
+            for (size_t i = first; i < std::min(first + probe_batch_size, changed.size()); ++i)
+            {
+                if (truncated[i])
+                    set_image(files[changed[i]], sniff_file(files[changed[i]].path.c_str()));
+            }
+        });
+    }
+
+    pool.run();
+
+    for (auto i : changed)
+    {
+        state[file_roots[i]].entries.push_back(std::move(files[i]));
+        ++state[file_roots[i]].n_probed;
+    }
+
+    size_t n_files{ 0 }, n_probed{ 0 };
+    for (auto& r : state)
+    {
+        // Sorted so the index doesn't change with the order the workers finished in
+        std::sort(r.entries.begin(), r.entries.end(), [](const Entry& a, const Entry& b) {
+            return a.path < b.path;
+        });
+
+        // Rewrite when files were added, changed or removed
+        if (r.n_probed > 0 || r.n_reused != r.old_entries.size())
+            write(r.index_path, r.entries);
+
+        n_files += r.entries.size();
+        n_probed += r.n_probed;
+
+        std::copy_if(r.entries.begin(),
+                     r.entries.end(),
+                     std::back_inserter(result.entries),
+                     [](const Entry& e) { return e.format != ImageFormat::Unsupported; });
+    }
+
+    // Roots may be nested in each other
+    std::sort(result.entries.begin(), result.entries.end(), [](const Entry& a, const Entry& b) {
+        return a.path < b.path;
+    });
+    auto duplicates{ std::unique(
+        result.entries.begin(), result.entries.end(), [](const Entry& a, const Entry& b) {
+            return a.path == b.path;
+        }) };
+    result.entries.erase(duplicates, result.entries.end());
+    std::sort(result.directories.begin(), result.directories.end());
+    result.directories.erase(std::unique(result.directories.begin(), result.directories.end()),
+                             result.directories.end());
+
+    spdlog::debug(fmt::format("Indexed {} files in {} directories, {} probed, took {}ms",
+                              n_files,
+                              result.directories.size(),
+                              n_probed,
+                              std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count()));
+
+    return result;
+}
+
+std::optional<WallpaperIndex::Entry> WallpaperIndex::probe_file(const std::string& path,
+                                                                const ScanOptions& options) const
+{
+    struct stat st;
+    if (!options.matches_file(fs::path{ path }.filename().c_str()) ||
+        stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return std::nullopt;
+
+    Entry entry{};
+    entry.path       = path;
+    entry.mtime_sec  = st.st_mtim.tv_sec;
+    entry.mtime_nsec = st.st_mtim.tv_nsec;
+    entry.size       = st.st_size;
+    set_image(entry, sniff_file(path.c_str()));
+
+    if (entry.format == ImageFormat::Unsupported)
+        return std::nullopt;
+
+    return entry;
+}
+
+std::vector<WallpaperIndex::Entry>
+WallpaperIndex::probe_files(const std::vector<std::string>& paths, const ScanOptions& options) const
+{
+    std::vector<Entry> files;
+    std::vector<const char*> file_paths;
+
+    for (const auto& path : paths)
+    {
+        if (options.matches_file(fs::path{ path }.filename().c_str()))
+            files.push_back({ .path = path });
+    }
+
+    for (const auto& e : files)
+        file_paths.push_back(e.path.c_str());
+
+    FileProber prober;
+    auto stats{ prober.stat(file_paths) };
+    std::vector<size_t> valid;
+    file_paths.clear();
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!stats[i].valid)
+            continue;
+
+        files[i].mtime_sec  = stats[i].mtime_sec;
+        files[i].mtime_nsec = stats[i].mtime_nsec;
+        files[i].size       = stats[i].size;
+        valid.push_back(i);
+        file_paths.push_back(files[i].path.c_str());
+    }
+
+    std::vector<uint8_t> truncated(valid.size(), false);
+    prober.read_headers(file_paths, [&](size_t i, const unsigned char* data, size_t len) {
+        auto& entry{ files[valid[i]] };
+        auto result{ sniff_image(data, len) };
+
+        set_image(entry, result);
+        truncated[i] = result.truncated && entry.size > len;
+    });
+
+    std::vector<Entry> entries;
+    for (size_t i = 0; i < valid.size(); ++i)
+    {
+        auto& entry{ files[valid[i]] };
+        if (truncated[i])
+            set_image(entry, sniff_file(entry.path.c_str()));
+
+        if (entry.format != ImageFormat::Unsupported)
+            entries.push_back(std::move(entry));
+    }
+
+    return entries;
+}
+
+std::string WallpaperIndex::get_index_path(const std::string& wallpaper_dir) const
+{
+    std::error_code ec;
+    auto dir{ fs::weakly_canonical(wallpaper_dir, ec) };
+
+    return fmt::format("{}/{:016x}.idx", m_Directory, fnv1a(ec ? wallpaper_dir : dir.string()));
+}
+
+std::vector<WallpaperIndex::Entry> WallpaperIndex::read(const std::string& index_path) const
+{
+    std::vector<Entry> entries;
+    int fd{ open(index_path.c_str(), O_RDONLY | O_CLOEXEC) };
+
+    if (fd < 0)
+        return entries;
+
+    struct stat st;
+    void* data{ MAP_FAILED };
+
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(IndexHeader))
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return entries;
+
+    size_t size{ static_cast<size_t>(st.st_size) };
+    const auto* header{ static_cast<const IndexHeader*>(data) };
+    bool valid{ header->magic == index_magic && header->version == index_version &&
+                header->count <= (size - sizeof(IndexHeader)) / sizeof(IndexRecord) &&
+                header->strings_size ==
+                    size - sizeof(IndexHeader) - header->count * sizeof(IndexRecord) };
+
+    const auto* records{ reinterpret_cast<const IndexRecord*>(header + 1) };
+    const auto* strings{ reinterpret_cast<const char*>(records + (valid ? header->count : 0)) };
+
+    for (uint64_t i = 0; valid && i < header->count; ++i)
+    {
+        const auto& r{ records[i] };
+        if (static_cast<uint64_t>(r.path_offset) + r.path_length > header->strings_size)
+        {
+            valid = false;
+            break;
+        }
+
+        entries.push_back({ std::string{ strings + r.path_offset, r.path_length },
+                            r.mtime_sec,
+                            r.mtime_nsec,
+                            r.size,
+                            static_cast<ImageFormat>(r.format),
+                            r.width,
+                            r.height });
+    }
+
+    munmap(data, size);
+
+    if (!valid)
+    {
+        spdlog::warn(fmt::format("Discarding corrupt wallpaper index {}", index_path));
+        entries.clear();
+    }
+
+    return entries;
+}
+
+void WallpaperIndex::write(const std::string& index_path, const std::vector<Entry>& entries) const
+{
+    IndexHeader header{};
+    header.magic   = index_magic;
+    header.version = index_version;
+    header.count   = entries.size();
+
+    std::vector<IndexRecord> records;
+    std::string strings;
+    records.reserve(entries.size());
+
+    for (const auto& e : entries)
+    {
+        IndexRecord r{};
+        r.mtime_sec   = e.mtime_sec;
+        r.mtime_nsec  = e.mtime_nsec;
+        r.size        = e.size;
+        r.path_offset = strings.size();
+        r.path_length = e.path.size();
+        r.width       = e.width;
+        r.height      = e.height;
+        r.format      = static_cast<uint8_t>(e.format);
+
+        records.push_back(r);
+        strings += e.path;
+    }
+
+    header.strings_size = strings.size();
+
+    // Write to a temporary file first so other instances never see a partial index
+    auto tmp_path{ fmt::format("{}.{}.{}.tmp",
+                               index_path,
+                               getpid(),
+                               std::hash<std::thread::id>{}(std::this_thread::get_id())) };
+    FILE* f{ fopen(tmp_path.c_str(), "wbe") };
+
+    if (!f)
+        return;
+
+    bool ok{ fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(records.data(), sizeof(IndexRecord), records.size(), f) == records.size() &&
+             fwrite(strings.data(), 1, strings.size(), f) == strings.size() };
+    ok = fclose(f) == 0 && ok;
+
+    if (!ok || rename(tmp_path.c_str(), index_path.c_str()) != 0)
+    {
+        spdlog::warn(fmt::format("Failed to write wallpaper index {}", index_path));
+        unlink(tmp_path.c_str());
+    }
+}
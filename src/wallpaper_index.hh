@@ -0,0 +1,68 @@
+#pragma once
+
+#include "image_sniffer.hh"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Persistent index of the wallpaper directories.
+// Every file's mtime, size, format and dimensions are kept in a memory-mapped binary file per
+// root directory, so a rescan only has to stat each file and only opens the ones that are new
+// or changed. Files that aren't images are remembered too so they aren't probed again.
+class WallpaperIndex
+{
+public:
+    struct Entry
+    {
+        std::string path;
+        int64_t mtime_sec, mtime_nsec;
+        uint64_t size;
+        ImageFormat format;
+        int width, height;
+    };
+
+    struct ScanOptions
+    {
+        // Whether subdirectories are scanned, symlinked directories are not followed
+        bool recursive{ false };
+        // Glob patterns matched against file names, when empty every file is included
+        std::vector<std::string> include;
+        // Glob patterns matched against file and directory names, excluded directories are
+        // not entered
+        std::vector<std::string> exclude;
+
+        bool matches_file(const char* name) const;
+        bool matches_directory(const char* name) const;
+    };
+
+    struct ScanResult
+    {
+        // Images sorted by path
+        std::vector<Entry> entries;
+        // Every directory that was read
+        std::vector<std::string> directories;
+    };
+
+    // Index files are kept in directory
+    WallpaperIndex(std::string directory);
+
+    // Walks all roots in parallel and returns the images in them, the index of a root is
+    // rewritten if anything in it changed
+    ScanResult scan(const std::vector<std::string>& roots, const ScanOptions& options) const;
+    // Stats and probes a single file, returns nothing if it isn't an image or is filtered out.
+    // The on-disk index catches up on the next scan.
+    std::optional<Entry> probe_file(const std::string& path, const ScanOptions& options) const;
+    // probe_file() for many files at once with the requests in flight together, returns the
+    // images among them. Safe to call from another thread.
+    std::vector<Entry> probe_files(const std::vector<std::string>& paths,
+                                   const ScanOptions& options) const;
+
+private:
+    std::string get_index_path(const std::string& wallpaper_dir) const;
+    std::vector<Entry> read(const std::string& index_path) const;
+    void write(const std::string& index_path, const std::vector<Entry>& entries) const;
+
+    std::string m_Directory;
+};
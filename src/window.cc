@@ -4,9 +4,23 @@
 using Random = effolkronium::random_static;
 
 #include "config.hh"
+#include "cost_model.hh"
+#include "decoder.hh"
+#include "deletion_queue.hh"
+#include "event_loop.hh"
+#include "pixel_pool.hh"
+#include "playlist.hh"
+#include "program_cache.hh"
+#include "resize.hh"
+#include "root_pixmap.hh"
 #include "shader.hh"
+#include "shader_library.hh"
 #include "texture.hh"
+#include "texture_pool.hh"
+#include "transition_source.hh"
 #include "transitions.hh"
+#include "upload.hh"
+#include "wallpaper_index.hh"
 
 #include <GL/glext.h>
 #include <X11/Xatom.h>
@@ -14,16 +28,20 @@ using Random = effolkronium::random_static;
 #include <X11/extensions/Xfixes.h>
 #include <X11/extensions/Xrender.h>
 #include <X11/extensions/shapeconst.h>
+#include <array>
 #include <chrono>
 #include <filesystem>
 namespace fs = std::filesystem;
 
 #include <map>
 #include <spdlog/spdlog.h>
-#include <stb/stb_image.h>
 #include <stdexcept>
 #include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_set>
 
 // clang-format off
 static const std::string vert_shader_source =
@@ -57,6 +75,15 @@ static const char* frag_shader_template =
 "}\n";
 // clang-format on
 
+static std::string build_fragment_source(const char* transition_src)
+{
+    auto len{ strlen(frag_shader_template) + strlen(transition_src) };
+    std::string frag(len, ' ');
+    snprintf(&frag[0], len, frag_shader_template, transition_src);
+
+    return frag;
+}
+
 PaperWindow::PaperWindow(DBusConnection* bus, Config* cfg)
     : m_Bus{ bus },
       m_Config{ std::move(cfg) },
@@ -175,11 +202,35 @@ PaperWindow::PaperWindow(DBusConnection* bus, Config* cfg)
     glXMakeCurrent(m_Display, m_Window, m_Context);
     // Enable adaptive vsync
     glXSwapIntervalEXT(m_Display, m_Window, -1);
+
+    m_Costs             = std::make_unique<CostModel>();
+    m_EventLoop         = std::make_unique<EventLoop>();
+    m_TransitionSources = std::make_unique<TransitionSourceCache>(4);
+
+    m_Index        = std::make_unique<WallpaperIndex>(m_Config->get_cache_directory() + "/index");
+    m_Watcher      = std::make_unique<DirectoryWatcher>(*m_EventLoop, [this](auto changes) {
+        apply_directory_changes(std::move(changes));
+    });
+    m_ProgramCache = std::make_unique<ProgramCache>(m_Config->get_cache_directory() + "/programs");
+    m_Shaders      = std::make_unique<ShaderLibrary>(
+        m_Display, m_FBconfig, m_Context, gl3attr, m_ProgramCache.get());
+
+    // One slot per prefetched image plus one for the upload in flight
+    m_UploadRing = std::make_unique<UploadRing>(m_Config->get_prefetch_count() + 1,
+                                                get_aligned_stride(m_Width) * m_Height);
+
+    unsigned int n_threads{ std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u) };
+    m_Decoder = std::make_unique<Decoder>(
+        n_threads, m_Width, m_Height, create_cache(), m_UploadRing.get());
 }
 
 PaperWindow::~PaperWindow()
 {
     // cleanup stuff enough though it doesnt matter
+    if (m_Probe.valid())
+        m_Probe.wait();
+    if (m_ProbeEventFd >= 0)
+        close(m_ProbeEventFd);
 }
 
 int PaperWindow::run()
@@ -189,11 +240,54 @@ int PaperWindow::run()
     setup_vbo();
     start_transition();
 
+    m_EventLoop->add(ConnectionNumber(m_Display), EPOLLIN, [this](uint32_t) {
+        handle_x_events();
+    });
+    m_EventLoop->add(m_Decoder->get_event_fd(), EPOLLIN, [this](uint32_t) {
+        m_Decoder->clear_event();
+    });
+    m_EventLoop->add_dbus(m_Bus);
+
+    m_ProbeEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_EventLoop->add(m_ProbeEventFd, EPOLLIN, [this](uint32_t) {
+        uint64_t count;
+        while (read(m_ProbeEventFd, &count, sizeof(count)) > 0)
+            ;
+        finish_probe();
+    });
+
     while (true)
     {
-        auto now{ steady_clock::now() };
-        std::apply(glClearColor, m_Config->get_bg_color());
-        glClear(GL_COLOR_BUFFER_BIT);
+        DeletionQueue::get().collect();
+        m_Shaders->poll();
+        poll_decoder();
+
+        // The idle wallpaper is read back ahead of the transition instead of when it starts
+        if (m_Idle && !m_RootRead.valid() && steady_clock::now() >= get_upload_time())
+            start_root_read();
+
+        handle_x_events();
+        handle_dbus_messages();
+
+        using namespace std::chrono;
+        auto display_end{ m_TransitionStart + m_Config->get_display_duration() };
+
+        if (!m_Animating && (m_TransitionPending || steady_clock::now() >= display_end))
+        {
+            bool scheduled{ !m_TransitionPending };
+            start_transition();
+
+            if (scheduled && m_TransitionPending)
+            {
+                ++m_DeadlineMisses;
+                spdlog::warn(fmt::format(
+                    "Next wallpaper wasn't ready in time ({} missed deadlines, {} decoding)",
+                    m_DeadlineMisses,
+                    m_Decoding.size()));
+            }
+        }
+
+        bool animating{ m_Animating };
 
         if (m_Animating)
         {
@@ -201,7 +295,7 @@ int PaperWindow::run()
             float t{ std::chrono::duration<float>(steady_clock::now() - m_TransitionStart).count() /
                      dur };
             t = std::min(1.0f, t);
-            m_Shader->set_1f("progress", t);
+            m_Shader->set(m_ProgressUniform, t);
 
             if (t >= 1.0f)
             {
@@ -210,53 +304,271 @@ int PaperWindow::run()
                 // setup for the next transition
                 setup_transition();
 
-                std::string path{ m_CurrentTexture->get_path() };
-                m_Config->set_current_texture_path(path);
+                m_Config->set_current_texture_path(m_CurrentTexture->get_path());
             }
         }
-        else
+
+        // The last frame stays on screen while idle, only draw when something changed
+        if (!m_Idle && (animating || m_NeedsRedraw))
         {
-            using namespace std::chrono;
-            dbus_connection_read_write(m_Bus, 1000);
-            DBusMessage* msg{ dbus_connection_pop_message(m_Bus) };
+            std::apply(glClearColor, m_Config->get_bg_color());
+            glClear(GL_COLOR_BUFFER_BIT);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-            if (msg)
-            {
-                if (dbus_message_is_method_call(
-                        msg, "com.github.ahodesuka.glpaper.new", "new_wallpaper"))
-                {
-                    start_transition();
-                    continue;
-                }
-                else if (dbus_message_is_method_call(
-                             msg, "com.github.ahodesuka.glpaper.reload", "reload_config"))
-                {
-                    // FIXME: This should do things when things change
-                    m_Config->load_config(true);
-                    load_paths();
-                    setup_transition();
-                    continue;
-                }
-
-                dbus_message_unref(msg);
-            }
+            // The transition just finished, this frame is what stays up until the next one
+            if (animating && !m_Animating && m_Config->get_idle_pixmap())
+                start_readback();
 
-            if (duration_cast<milliseconds>(steady_clock::now() - m_TransitionStart) >=
-                m_Config->get_display_duration())
+            glXSwapBuffers(m_Display, m_Window);
+            m_NeedsRedraw = false;
+        }
+
+        if (m_UploadFence)
+        {
+            GLenum res{ glClientWaitSync(m_UploadFence, 0, 0) };
+            if (res == GL_ALREADY_SIGNALED || res == GL_CONDITION_SATISFIED)
             {
-                start_transition();
-                continue;
+                auto [w, h]{ m_UploadSize };
+                m_Costs->record_upload(w, h, steady_clock::now() - m_UploadStart);
+                glDeleteSync(m_UploadFence);
+                m_UploadFence = nullptr;
             }
         }
 
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        if (m_ReadbackFence)
+        {
+            GLenum res{ glClientWaitSync(m_ReadbackFence, 0, 0) };
+            if (res == GL_ALREADY_SIGNALED || res == GL_CONDITION_SATISFIED)
+                enter_idle();
+        }
+
+        // Swapping paces the loop while animating, background work that has no fd to wait
+        // on is polled, otherwise sleep until an event or the next wallpaper change
+        int timeout{ -1 };
+        if (m_Animating)
+            timeout = 0;
+        else if (DeletionQueue::get().has_pending() || m_Shaders->is_busy() || m_ReadbackFence ||
+                 m_UploadFence)
+            timeout = background_poll_ms;
+
+        // A pending transition is past its deadline already, the decoder's event fd wakes the
+        // loop up when its wallpaper is ready
+        if (m_TransitionPending && !m_Animating)
+            m_EventLoop->clear_deadline();
+        else if (!m_Animating)
+        {
+            // Wake up for the upload only while it can still happen, an image that isn't
+            // decoded yet is uploaded as soon as the decoder's event fd says it is done. While
+            // idle the root pixmap is read back at that time instead.
+            auto deadline{ m_TransitionStart + m_Config->get_display_duration() };
+            if (auto upload{ get_upload_time() };
+                (m_Idle ? !m_RootRead.valid() : can_upload_next_texture()) &&
+                upload > steady_clock::now())
+                deadline = std::min(deadline, upload);
+            m_EventLoop->set_deadline(deadline);
+        }
 
-        glXSwapBuffers(m_Display, m_Window);
+        XFlush(m_Display);
+        m_EventLoop->wait(timeout);
     }
 
     return EXIT_SUCCESS;
 }
 
+void PaperWindow::handle_x_events()
+{
+    // Xlib may have read events into its queue while doing something else, so this also has
+    // to run before waiting on the connection's fd
+    while (XPending(m_Display))
+    {
+        XEvent ev;
+        XNextEvent(m_Display, &ev);
+
+        if (ev.type == Expose)
+            m_NeedsRedraw = true;
+    }
+}
+
+void PaperWindow::handle_dbus_messages()
+{
+    while (DBusMessage* msg{ dbus_connection_pop_message(m_Bus) })
+    {
+        if (dbus_message_is_method_call(msg, "com.github.ahodesuka.glpaper.new", "new_wallpaper"))
+        {
+            // Starts as soon as the current transition, if any, is done
+            m_TransitionPending = true;
+        }
+        else if (dbus_message_is_method_call(
+                     msg, "com.github.ahodesuka.glpaper.stats", "get_stats"))
+        {
+            auto stats{ get_stats() };
+            const char* str{ stats.c_str() };
+
+            DBusMessage* reply{ dbus_message_new_method_return(msg) };
+            dbus_message_append_args(reply, DBUS_TYPE_STRING, &str, DBUS_TYPE_INVALID);
+            dbus_connection_send(m_Bus, reply, nullptr);
+            dbus_message_unref(reply);
+        }
+        else if (dbus_message_is_method_call(
+                     msg, "com.github.ahodesuka.glpaper.reload", "reload_config"))
+        {
+            // FIXME: This should do things when things change
+            m_Config->load_config(true);
+            m_Decoder->set_cache(create_cache());
+            load_paths();
+            // The enabled transitions may have changed, queue a new next one right away in
+            // case the window is idle
+            m_NextTransition = pick_transition();
+            precompile_transition(m_NextTransition);
+            if (!m_Animating && !m_Idle)
+                setup_transition();
+        }
+
+        dbus_message_unref(msg);
+    }
+}
+
+void PaperWindow::start_readback()
+{
+    auto size{ static_cast<GLsizeiptr>(m_Width) * m_Height * 4 };
+
+    glGenBuffers(1, &m_ReadbackBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_ReadbackBuffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+
+    // Copies into the buffer on the GPU's timeline, the fence tells when it can be mapped
+    glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, m_Width, m_Height, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    m_ReadbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+}
+
+void PaperWindow::cancel_readback()
+{
+    if (!m_ReadbackFence)
+        return;
+
+    glDeleteSync(m_ReadbackFence);
+    m_ReadbackFence = nullptr;
+    DeletionQueue::get().delete_buffer(m_ReadbackBuffer);
+    m_ReadbackBuffer = 0;
+}
+
+void PaperWindow::enter_idle()
+{
+    auto size{ static_cast<GLsizeiptr>(m_Width) * m_Height * 4 };
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_ReadbackBuffer);
+    auto* pixels{ static_cast<const unsigned char*>(
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT)) };
+
+    bool is_set{ pixels && set_root_pixmap(m_Display, pixels, m_Width, m_Height) };
+
+    if (pixels)
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    cancel_readback();
+
+    if (!is_set)
+        return;
+
+    // The root window shows the same frame now, give the GPU memory back until the next
+    // transition
+    XUnmapWindow(m_Display, m_Window);
+    XFlush(m_Display);
+
+    // The next transition's program is kept so leaving idle doesn't build it on the render
+    // thread, the others are queued again by setup_transition()
+    m_Shader = nullptr;
+    m_Shaders->clear(m_NextTransition);
+    m_CurrentTexture.reset();
+    m_NextTexture.reset();
+    TexturePool::get().trim();
+    PixelPool::get().trim();
+
+    m_Idle = true;
+    spdlog::debug("Set the root pixmap, idling until the next transition");
+}
+
+void PaperWindow::leave_idle()
+{
+    m_Idle = false;
+
+    XMapWindow(m_Display, m_Window);
+    XLowerWindow(m_Display, m_Window);
+
+    // Transition away from whatever is on the root window, another program may have replaced
+    // it in the meantime. Only a transition started early still has to wait for the read.
+    if (!m_RootRead.valid())
+        start_root_read();
+
+    if (auto img{ m_RootRead.get() })
+    {
+        img->path        = PathStore::get().get_path(m_Config->get_current_texture_path());
+        m_CurrentTexture = std::make_unique<Texture>(*img);
+    }
+    else
+    {
+        // Not null, load_textures() would take it for the first start and show the current
+        // wallpaper again
+        m_CurrentTexture = std::make_unique<Texture>(m_Config->get_bg_color());
+    }
+
+    setup_transition();
+}
+
+void PaperWindow::start_root_read()
+{
+    auto read{ [name = std::string{ DisplayString(m_Display) }, w = m_Width, h = m_Height]() {
+        return read_root_pixmap(name.c_str(), w, h);
+    } };
+
+    m_RootRead = std::async(std::launch::async, std::move(read));
+}
+
+std::unique_ptr<BlobCache> PaperWindow::create_cache() const
+{
+    if (m_Config->get_cache_size() == 0)
+        return nullptr;
+
+    return std::make_unique<BlobCache>(
+        m_Config->get_cache_directory(), m_Config->get_cache_size(), m_Width, m_Height);
+}
+
+std::string PaperWindow::get_stats() const
+{
+    const auto& paths{ PathStore::get() };
+    const auto& pool{ PixelPool::get() };
+    const auto& textures{ TexturePool::get() };
+
+    return fmt::format("transitions: {}\n"
+                       "missed deadlines: {}\n"
+                       "prefetched: {}, decoding: {}\n"
+                       "wallpapers: {}{}, {} paths in {} KiB\n"
+                       "memory: {} MiB resident, {} MiB peak, {} MiB when idle\n"
+                       "pixel pool: {} MiB used, {} MiB free\n"
+                       "texture pool: {} hits, {} misses\n",
+                       m_TransitionCount,
+                       m_DeadlineMisses,
+                       m_Prefetched.size(),
+                       m_Decoding.size(),
+                       m_Playlist ? m_Playlist->get_indexed() : m_WallpaperPaths.size(),
+                       m_Playlist && !m_Playlist->is_indexed() ? " indexed so far" : "",
+                       paths.size(),
+                       paths.get_memory_usage() >> 10,
+                       get_resident_memory() >> 20,
+                       get_peak_resident_memory() >> 20,
+                       pool.get_idle_resident() >> 20,
+                       pool.get_used() >> 20,
+                       pool.get_free() >> 20,
+                       textures.get_hits(),
+                       textures.get_misses()) +
+           m_Costs->get_summary();
+}
+
 void PaperWindow::setup_vbo()
 {
     // clang-format off
@@ -284,31 +596,40 @@ void PaperWindow::setup_vbo()
 
 void PaperWindow::create_shader()
 {
-    std::string transition_str;
-    try
+    auto it{ transitions_map.find(m_Transition) };
+
+    // Built already, the source doesn't have to be inflated again
+    if (auto* shader{ it != transitions_map.end() ? m_Shaders->find(m_Transition) : nullptr };
+        shader && shader->get_id() != 0)
     {
-        transition_str = reinterpret_cast<const char*>(transitions_map.at(m_Transition));
+        m_TransitionInfo = &it->second;
+        m_Shader         = shader;
+        return;
     }
-    catch (const std::out_of_range&)
+
+    std::shared_ptr<const std::string> source;
+
+    if (it != transitions_map.end())
+        source = m_TransitionSources->get(*it);
+
+    if (!source)
     {
-        if (m_Transition != "fade")
-        {
-            spdlog::error(
-                fmt::format("Failed to find transition '{}', falling back to fade", m_Transition));
-            m_Transition   = "fade";
-            transition_str = reinterpret_cast<const char*>(transitions_map.at(m_Transition));
-        }
-        else
-        {
-            throw std::runtime_error("Failed to find fade transition");
-        }
+        if (m_Transition == "fade")
+            throw std::runtime_error("Failed to load fade transition");
+
+        spdlog::error(
+            fmt::format("Failed to load transition '{}', falling back to fade", m_Transition));
+        m_Transition = "fade";
+        create_shader();
+        return;
     }
 
-    auto len{ strlen(frag_shader_template) + transition_str.length() };
-    std::string frag(len, ' ');
-    snprintf(&frag[0], len, frag_shader_template, transition_str.c_str());
+    m_TransitionInfo = &it->second;
 
-    m_Shader = std::make_unique<Shader>(vert_shader_source, frag);
+    m_Shader = m_Shaders->get(m_Transition,
+                              vert_shader_source,
+                              build_fragment_source(source->c_str()),
+                              it->second.uniforms);
 
     if (m_Shader->get_id() == 0 && m_Transition != "fade")
     {
@@ -319,119 +640,601 @@ void PaperWindow::create_shader()
     }
 }
 
+std::string PaperWindow::pick_transition() const
+{
+    if (m_Config->get_enabled_transitions().empty())
+        return std::string{ Random::get(transitions_map)->first };
+
+    return *Random::get(m_Config->get_enabled_transitions());
+}
+
+void PaperWindow::precompile_transitions()
+{
+    // Queued first, it is the one needed soonest. Fade is the fallback whenever another
+    // transition fails.
+    precompile_transition(m_NextTransition);
+    precompile_transition("fade");
+
+    if (m_Config->get_enabled_transitions().empty())
+    {
+        for (const auto& [name, info] : transitions_map)
+            precompile_transition(std::string{ name });
+    }
+    else
+    {
+        for (const auto& name : m_Config->get_enabled_transitions())
+            precompile_transition(name);
+    }
+}
+
+void PaperWindow::precompile_transition(const std::string& name)
+{
+    if (m_Shaders->contains(name))
+        return;
+
+    const auto* entry{ transitions_map.find(name) };
+    if (entry == transitions_map.end())
+        return;
+
+    auto frag{ [entry]() {
+        auto source{ TransitionSourceCache::inflate(*entry) };
+        return source ? build_fragment_source(source->c_str()) : std::string{};
+    } };
+
+    m_Shaders->precompile(name, vert_shader_source, std::move(frag), entry->second.uniforms);
+}
+
 void PaperWindow::load_textures()
 {
     if (m_CurrentTexture)
     {
-        m_CurrentTexture = std::move(m_NextTexture);
-        m_NextTexture    = std::make_unique<Texture>(get_random_texture_path());
+        if (m_NextTexture)
+            m_CurrentTexture = std::move(m_NextTexture);
     }
     else
     {
-        auto cur{ m_Config->get_current_texture_path() };
         m_CurrentTexture = std::make_unique<Texture>(m_Config->get_bg_color());
+        m_PreferredPath  = PathStore::get().get_path(m_Config->get_current_texture_path());
 
-        if (cur.empty())
-        {
-            m_NextTexture = std::make_unique<Texture>(get_random_texture_path());
-        }
-        else
-        {
-            m_NextTexture = std::make_unique<Texture>(cur);
-        }
+        if (!m_PreferredPath.empty())
+            submit_decode(m_PreferredPath);
     }
 
-    m_CurrentTexture->bind(0);
-    m_Shader->set_1i("from", 0);
-    m_NextTexture->bind(1);
-    m_Shader->set_1i("to", 1);
+    // The next wallpaper is only uploaded shortly before it is shown, see get_upload_time()
+    prefetch();
+    bind_textures();
 }
 
-void PaperWindow::set_uniforms()
+void PaperWindow::bind_textures()
 {
-    auto ratio{ m_Width / m_Height };
+    m_CurrentTexture->bind(0);
+    m_Shader->set(m_Shader->get_uniform<int>("from", true), 0);
 
-    if (m_Transition == "circlecrop" || m_Transition == "gridflip")
+    if (m_NextTexture)
     {
-        m_Shader->set_4f("bgcolor", m_Config->get_bg_color());
+        m_NextTexture->bind(1);
+        m_Shader->set(m_Shader->get_uniform<int>("to", true), 1);
     }
+}
 
-    if (m_Transition == "gridflip")
-    {
-        m_Shader->set_2f("size", { ratio * 4.0f, 4.0f });
-        m_Shader->set_1f("dividerWidth", 0.05f / ratio);
-    }
+void PaperWindow::prefetch()
+{
+    auto count{ static_cast<size_t>(m_Config->get_prefetch_count()) };
 
-    if (m_Transition == "randomsquares" || m_Transition == "squareswire")
+    // Hedge with one more decode when none of the pending ones is expected to be done
+    // before the next wallpaper has to be uploaded, whichever finishes first is used
+    if (m_Prefetched.empty() && !m_Decoding.empty())
     {
-        m_Shader->set_2f("size", { ratio * 10.0f, 10.0f });
+        auto first_done{ std::min_element(
+            m_Decoding.begin(), m_Decoding.end(), [](const auto& a, const auto& b) {
+                return a.second < b.second;
+            }) };
+
+        if (first_done->second > get_upload_time())
+            ++count;
     }
 
-    if (m_Transition == "squareswire" || m_Transition == "directionalwarp" ||
-        m_Transition == "directionalwipe")
+    while ((m_Playlist || m_WallpaperPaths.size() >= 2) &&
+           m_Decoder->get_pending() + m_Prefetched.size() < count)
     {
-        m_Shader->set_2f("direction", { Random::get(-1.0f, 1.0f), Random::get(-1.0f, 1.0f) });
+        auto path{ get_next_texture_path() };
+        if (path.empty() || !submit_decode(std::move(path)))
+            break;
     }
+}
+
+bool PaperWindow::submit_decode(std::string path)
+{
+    std::error_code ec;
+    auto file_size{ fs::file_size(path, ec) };
+    auto estimate{ m_Costs->estimate_decode(path, ec ? 0 : file_size) };
 
-    if (m_Transition == "directional_easing" || m_Transition == "directional")
+    if (!m_Decoder->submit(path))
+        return false;
+
+    m_Decoding.emplace_back(std::move(path), steady_clock::now() + estimate);
+    return true;
+}
+
+bool PaperWindow::poll_decoder()
+{
+    bool got_image{ false };
+    Image img;
+
+    m_UploadRing->collect();
+
+    while (m_Decoder->poll(img))
     {
-        auto x{ Random::get(0.0f, 1.0f) };
-        auto y = x == 1.0f ? 0.0f : 1.0f;
-        m_Shader->set_2f("direction", { x, y });
+        auto decoding{ std::find_if(m_Decoding.begin(), m_Decoding.end(), [&](const auto& d) {
+            return d.first == img.path;
+        }) };
+        if (decoding != m_Decoding.end())
+            m_Decoding.erase(decoding);
+
+        bool preferred{ img.path == m_PreferredPath };
+        if (preferred)
+            m_PreferredPath.clear();
+
+        // A hedged decode can finish after another decode of the same file, it would be shown
+        // after itself
+        if (!preferred && img.path == get_previous_path())
+            continue;
+
+        if (!img.pixels)
+        {
+            // Don't pick the broken file again, prefetch() will queue another one instead
+            if (m_Playlist)
+                m_Playlist->remove(img.path);
+            else
+                std::erase(m_WallpaperPaths, PathStore::get().find(img.path));
+            continue;
+        }
+
+        // Cache hits say nothing about how long the file takes to decode
+        if (!img.from_cache)
+        {
+            m_Costs->record_decode(
+                img.path, img.file_size, img.decode_time - img.resize_time, img.resize_time);
+        }
+
+        if (preferred)
+            m_Prefetched.push_front(std::move(img));
+        else
+            m_Prefetched.push_back(std::move(img));
+
+        got_image = true;
     }
 
-    if (m_Transition == "luminance_melt")
+    if (got_image || m_Decoder->get_pending() == 0)
+        prefetch();
+
+    if (!m_Idle && steady_clock::now() >= get_upload_time())
+        upload_next_texture();
+
+    return got_image;
+}
+
+std::string PaperWindow::get_previous_path() const
+{
+    if (!m_Prefetched.empty())
+        return m_Prefetched.back().path;
+
+    const auto& texture{ m_NextTexture ? m_NextTexture : m_CurrentTexture };
+    return texture ? PathStore::get().get_path(texture->get_path()) : std::string{};
+}
+
+bool PaperWindow::upload_next_texture()
+{
+    if (!can_upload_next_texture())
+        return false;
+
+    if (m_UploadFence)
+        glDeleteSync(m_UploadFence);
+
+    m_UploadStart = steady_clock::now();
+    m_NextTexture = std::make_unique<Texture>(m_Prefetched.front(), m_UploadRing.get());
+    m_UploadFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    m_UploadSize  = { m_NextTexture->get_width(), m_NextTexture->get_height() };
+    m_Prefetched.pop_front();
+    bind_textures();
+
+    return true;
+}
+
+bool PaperWindow::can_upload_next_texture() const
+{
+    // Hold off until the preferred image is ready so it is shown first
+    return !m_NextTexture && !m_Prefetched.empty() && m_PreferredPath.empty();
+}
+
+steady_clock::time_point PaperWindow::get_upload_time() const
+{
+    // Twice the average with some slack on top, the upload has to be done before the
+    // transition starts
+    auto lead{ m_Costs->estimate_upload(m_Width, m_Height) * 2 + upload_slack };
+
+    return m_TransitionStart + m_Config->get_display_duration() - lead;
+}
+
+void PaperWindow::set_uniforms()
+{
+    auto ratio{ static_cast<float>(m_Width) / m_Height };
+    const auto& uniforms{ m_TransitionInfo->uniforms };
+
+    // The program resolved these when it was linked, in the same order
+    for (size_t i = 0; i < uniforms.size(); ++i)
     {
-        m_Shader->set_1i("direction", Random::get(0, 1));
+        const auto& u{ uniforms[i] };
+        auto value{ u.value };
+
+        if (u.flags & UniformBGColor)
+            value = m_Config->get_bg_color();
+
+        if (u.flags & UniformRandom)
+        {
+            for (size_t i = 0; i < value.size(); ++i)
+            {
+                if (u.kind == UniformKind::Int)
+                    value[i] = Random::get(static_cast<int>(u.min[i]), static_cast<int>(u.max[i]));
+                else
+                    value[i] = Random::get(u.min[i], u.max[i]);
+            }
+        }
+
+        if (u.flags & UniformRatio)
+            value[0] *= ratio;
+
+        if (u.flags & UniformInvRatio)
+        {
+            for (auto& v : value)
+                v /= ratio;
+        }
+
+        switch (u.kind)
+        {
+        case UniformKind::Int:
+            m_Shader->set(m_Shader->get_declared<int>(i), static_cast<int>(value[0]));
+            break;
+        case UniformKind::Float:
+            m_Shader->set(m_Shader->get_declared<float>(i), value[0]);
+            break;
+        case UniformKind::Vec2:
+            m_Shader->set(m_Shader->get_declared<std::array<float, 2>>(i), { value[0], value[1] });
+            break;
+        case UniformKind::Vec3:
+            m_Shader->set(m_Shader->get_declared<std::array<float, 3>>(i),
+                          { value[0], value[1], value[2] });
+            break;
+        case UniformKind::Vec4:
+            m_Shader->set(m_Shader->get_declared<std::array<float, 4>>(i), value);
+            break;
+        }
     }
 }
 
 void PaperWindow::setup_transition()
 {
-    if (m_Config->get_enabled_transitions().empty())
-        m_Transition = Random::get(transitions_map)->first;
-    else
-        m_Transition = *Random::get(m_Config->get_enabled_transitions());
-
+    m_Transition = m_NextTransition.empty() ? pick_transition() : std::move(m_NextTransition);
     create_shader();
 
+    m_NextTransition = pick_transition();
+    precompile_transitions();
+
     glUseProgram(m_Shader->get_id());
-    m_Shader->set_1f("ratio", static_cast<float>(m_Width) / m_Height);
-    m_Shader->set_1f("progress", 0.0f);
+    m_ProgressUniform = m_Shader->get_uniform<float>("progress", true);
+    m_Shader->set(m_Shader->get_uniform<float>("ratio", true),
+                  static_cast<float>(m_Width) / m_Height);
+    m_Shader->set(m_ProgressUniform, 0.0f);
 
     set_uniforms();
     load_textures();
+    m_NeedsRedraw = true;
 }
 
 void PaperWindow::start_transition()
 {
-    m_Animating       = true;
-    m_TransitionStart = steady_clock::now();
-    m_TransitionEnd   = m_TransitionStart + m_Config->get_transition_duration();
+    cancel_readback();
+
+    if (m_Idle)
+        leave_idle();
+
+    if (!m_NextTexture && !upload_next_texture())
+    {
+        m_TransitionPending = true;
+        return;
+    }
+
+    ++m_TransitionCount;
+    m_TransitionPending = false;
+    m_Animating         = true;
+    m_TransitionStart   = steady_clock::now();
+    m_TransitionEnd     = m_TransitionStart + m_Config->get_transition_duration();
 }
 
 void PaperWindow::load_paths()
 {
     m_WallpaperPaths.clear();
+    m_NextPath = 0;
+    m_ProbeQueue.clear();
+    m_ProbeRemoved.clear();
+    m_RescanQueued = false;
+    m_ProbeStale   = m_Probe.valid();
+
+    // Playlist entries are only checked once they are picked, there is nothing to scan
+    if (!m_Config->get_playlist().empty())
+    {
+        m_Playlist = std::make_unique<Playlist>(m_Config->get_playlist());
+        m_Watcher->watch({});
+
+        auto validate{ [this](const std::string& path) {
+            return m_Index->probe_file(path, {}).has_value();
+        } };
+        if (m_Playlist->count_valid(validate, 2) < 2)
+            throw std::runtime_error("Playlist contains less than 2 valid image files");
+
+        compact_paths();
+        return;
+    }
+
+    m_Playlist.reset();
 
-    for (const auto& entry : fs::directory_iterator(m_Config->get_wallpaper_directory()))
-        if (stbi_info(entry.path().c_str(), nullptr, nullptr, nullptr))
-            m_WallpaperPaths.emplace_back(entry.path());
+    m_ScanOptions = { m_Config->get_recursive(), m_Config->get_include(), m_Config->get_exclude() };
+    set_wallpapers(m_Index->scan(m_Config->get_wallpaper_directories(), m_ScanOptions));
 
     if (m_WallpaperPaths.size() < 2)
         throw std::runtime_error("Wallpaper directory contains less than 2 valid image files");
 }
 
-std::string PaperWindow::get_random_texture_path()
+void PaperWindow::set_wallpapers(const WallpaperIndex::ScanResult& scan)
 {
-    auto iter{ Random::get(m_WallpaperPaths) };
+    m_WallpaperPaths.clear();
+    m_NextPath = 0;
+    m_Watcher->watch(scan.directories, m_ScanOptions.recursive);
+
+    auto& paths{ PathStore::get() };
+    for (const auto& entry : scan.entries)
+        m_WallpaperPaths.push_back(paths.add(entry.path));
 
-    if (m_CurrentTexture && m_CurrentTexture->get_path() == *iter)
+    compact_paths();
+    spdlog::debug(fmt::format("{} wallpapers, paths take {} bytes each",
+                              m_WallpaperPaths.size(),
+                              paths.get_memory_usage() / std::max<size_t>(paths.size(), 1)));
+}
+
+void PaperWindow::compact_paths()
+{
+    auto& paths{ PathStore::get() };
+    std::array textures{ m_CurrentTexture.get(), m_NextTexture.get() };
+
+    std::vector<PathStore::Id> live{ m_WallpaperPaths };
+    live.push_back(m_Config->get_current_texture_path());
+    for (const auto* texture : textures)
     {
-        // Wrap the iter if its the last one
-        if (++iter == m_WallpaperPaths.end())
-            iter = m_WallpaperPaths.begin();
+        if (texture)
+            live.push_back(texture->get_path());
+    }
+
+    // Rescans and shown playlist entries only ever add paths, rebuilding once they make up
+    // half of the store keeps it at most twice the size of the live ones
+    if (paths.size() <= std::max<size_t>(live.size() * 2, min_compact_paths))
+        return;
+
+    auto ids{ paths.compact(live) };
+    auto remap{ [&](PathStore::Id id) { return id < ids.size() ? ids[id] : id; } };
+
+    for (auto& id : m_WallpaperPaths)
+        id = remap(id);
+    for (auto* texture : textures)
+    {
+        if (texture)
+            texture->set_path(remap(texture->get_path()));
+    }
+    m_Config->remap_current_texture_path(remap(m_Config->get_current_texture_path()));
+
+    spdlog::debug(fmt::format("Compacted the path store from {} to {} paths", ids.size(),
+                              paths.size()));
+}
+
+void PaperWindow::apply_directory_changes(DirectoryWatcher::Changes changes)
+{
+    // Walking every root would stall rendering, the rescan covers the files waiting to be
+    // probed
+    if (changes.rescan)
+    {
+        m_RescanQueued = true;
+        m_ProbeQueue.clear();
+        start_probe();
+        return;
+    }
+
+    auto& paths{ PathStore::get() };
+
+    // Rewritten files are reported as added, drop them and probe them again like new ones
+    std::unordered_set<PathStore::Id> changed;
+    for (const auto* list : { &changes.removed, &changes.added })
+    {
+        for (const auto& path : *list)
+            changed.insert(paths.find(path));
+    }
+    std::erase_if(m_WallpaperPaths, [&](PathStore::Id id) { return changed.contains(id); });
+
+    // Files that aren't in the path store yet can still be waiting to be probed
+    std::unordered_set<std::string_view> changed_paths;
+    for (const auto* list : { &changes.removed, &changes.added })
+        changed_paths.insert(list->begin(), list->end());
+    std::erase_if(m_ProbeQueue,
+                  [&](const std::string& path) { return changed_paths.contains(path); });
+
+    // The batch in flight may have read them before they were removed
+    if (m_Probe.valid())
+        m_ProbeRemoved.insert(changes.removed.begin(), changes.removed.end());
+
+    // Probing a bulk copy of thousands of files would stall rendering
+    m_ProbeQueue.insert(m_ProbeQueue.end(), changes.added.begin(), changes.added.end());
+    start_probe();
+
+    spdlog::debug(fmt::format("Removed {} files, probing {} added ones, {} wallpapers",
+                              changes.removed.size(),
+                              m_ProbeQueue.size(),
+                              m_WallpaperPaths.size()));
+
+    prefetch();
+}
+
+void PaperWindow::start_probe()
+{
+    if (m_Probe.valid() || (!m_RescanQueued && m_ProbeQueue.empty()) || m_ProbeEventFd < 0)
+        return;
+
+    m_ProbeRescan = std::exchange(m_RescanQueued, false);
+
+    auto probe{ [this,
+                 rescan  = m_ProbeRescan,
+                 roots   = m_Config->get_wallpaper_directories(),
+                 files   = std::exchange(m_ProbeQueue, {}),
+                 options = m_ScanOptions]() {
+        WallpaperIndex::ScanResult result;
+        if (rescan)
+            result = m_Index->scan(roots, options);
+        else
+            result.entries = m_Index->probe_files(files, options);
+
+        uint64_t one{ 1 };
+        [[maybe_unused]] auto ret{ write(m_ProbeEventFd, &one, sizeof(one)) };
+
+        return result;
+    } };
+
+    m_Probe = std::async(std::launch::async, std::move(probe));
+}
+
+void PaperWindow::finish_probe()
+{
+    using namespace std::chrono_literals;
+    if (!m_Probe.valid() || m_Probe.wait_for(0s) != std::future_status::ready)
+        return;
+
+    auto result{ m_Probe.get() };
+    auto removed{ std::exchange(m_ProbeRemoved, {}) };
+
+    std::erase_if(result.entries, [&](const WallpaperIndex::Entry& entry) {
+        return removed.contains(entry.path);
+    });
+
+    // Stale if the wallpapers were loaded again in the meantime
+    if (std::exchange(m_ProbeStale, false))
+    {
+        start_probe();
+        return;
+    }
+
+    if (m_ProbeRescan)
+    {
+        set_wallpapers(result);
+
+        if (m_WallpaperPaths.size() < 2)
+            spdlog::error("Wallpaper directory contains less than 2 valid image files");
+    }
+    else
+    {
+        auto& paths{ PathStore::get() };
+        // A file can be reported again while it is being probed
+        std::unordered_set<PathStore::Id> known(m_WallpaperPaths.begin(), m_WallpaperPaths.end());
+
+        for (const auto& entry : result.entries)
+        {
+            if (auto id{ paths.add(entry.path) }; known.insert(id).second)
+                m_WallpaperPaths.push_back(id);
+        }
+
+        spdlog::debug(fmt::format("Added {} probed wallpapers, {} wallpapers",
+                                  result.entries.size(),
+                                  m_WallpaperPaths.size()));
+    }
+
+    start_probe();
+    prefetch();
+}
+
+std::vector<std::string> PaperWindow::get_queued_paths() const
+{
+    auto& paths{ PathStore::get() };
+    std::vector<std::string> queued;
+
+    auto add{ [&](std::string path) {
+        if (!path.empty())
+            queued.push_back(std::move(path));
+    } };
+
+    // The current texture is released while idle, the config still knows its path
+    add(paths.get_path(m_Config->get_current_texture_path()));
+    if (m_CurrentTexture)
+        add(paths.get_path(m_CurrentTexture->get_path()));
+    if (m_NextTexture)
+        add(paths.get_path(m_NextTexture->get_path()));
+
+    for (const auto& img : m_Prefetched)
+        add(img.path);
+    for (const auto& [path, done] : m_Decoding)
+        add(path);
+
+    return queued;
+}
+
+std::string PaperWindow::get_next_texture_path()
+{
+    bool sequential{ m_Config->get_order() == Config::Order::Sequential };
+
+    // Picking one of these again would show the same wallpaper twice, the last one is what
+    // the pick is shown after
+    auto queued{ get_queued_paths() };
+    auto is_queued{ [&](const std::string& path) {
+        return std::ranges::find(queued, path) != queued.end();
+    } };
+
+    if (m_Playlist)
+    {
+        auto validate{ [this](const std::string& path) {
+            return m_Index->probe_file(path, {}).has_value();
+        } };
+
+        // Its entries aren't all known, a few picks are tried and a short list gets one of
+        // the queued wallpapers in the end
+        std::string path;
+        for (int i = 0; i < max_pick_tries; ++i)
+        {
+            path = sequential ? m_Playlist->get_next(validate) : m_Playlist->get_random(validate);
+            if (path.empty() || !is_queued(path))
+                break;
+        }
+
+        return path;
+    }
+
+    auto& paths{ PathStore::get() };
+    auto size{ m_WallpaperPaths.size() };
+    auto start{ sequential ? m_NextPath % size : Random::get<size_t>(0, size - 1) };
+
+    // Walks on from the pick until a wallpaper that isn't queued, with fewer wallpapers than
+    // that only the one it would follow is avoided
+    for (bool fallback : { false, true })
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            auto pos{ (start + i) % size };
+            auto path{ paths.get_path(m_WallpaperPaths[pos]) };
+
+            if (fallback ? !queued.empty() && path == queued.back() : is_queued(path))
+                continue;
+
+            if (sequential)
+                m_NextPath = pos + 1;
+
+            return path;
+        }
     }
 
-    return *iter;
+    m_NextPath = start + 1;
+    return paths.get_path(m_WallpaperPaths[start]);
 }
@@ -5,14 +5,33 @@
 #include <X11/Xlib.h>
 #include <chrono>
 #include <dbus/dbus.h>
+#include <deque>
+#include <future>
 #include <memory>
+#include <optional>
+#include <unordered_set>
 #include <vector>
 
+#include "directory_watcher.hh"
+#include "image.hh"
+#include "path_store.hh"
+#include "shader.hh"
+#include "wallpaper_index.hh"
+
 using std::chrono::steady_clock;
 
+class BlobCache;
 class Config;
-class Shader;
+class CostModel;
+class Decoder;
+class EventLoop;
+class Playlist;
+class ProgramCache;
+class ShaderLibrary;
+class TransitionSourceCache;
+struct TransitionInfo;
 class Texture;
+class UploadRing;
 
 class PaperWindow
 {
@@ -23,28 +42,148 @@ public:
     int run();
 
 private:
+    // Added to the measured upload time when scheduling the next upload
+    static constexpr std::chrono::milliseconds upload_slack{ 250 };
+    // How often work without a file descriptor to wait on (fences, shader builds) is polled
+    static constexpr int background_poll_ms{ 16 };
+    // Playlist picks tried per prefetch to find a wallpaper that isn't queued already
+    static constexpr int max_pick_tries{ 8 };
+    // The path store isn't compacted below this many paths
+    static constexpr size_t min_compact_paths{ 1024 };
+
+    // Drains the X event queue
+    void handle_x_events();
+    // Handles the method calls queued on the bus
+    void handle_dbus_messages();
+    // Counters and measured load costs, returned by the get_stats method call
+    std::string get_stats() const;
+    // Cache of decoded wallpapers as configured, null if it is disabled
+    std::unique_ptr<BlobCache> create_cache() const;
+
     void setup_vbo();
     void create_shader();
+    // Picks one of the enabled transitions at random
+    std::string pick_transition() const;
+    // Queues the enabled transitions that aren't built yet, m_NextTransition first
+    void precompile_transitions();
+    // Queues a transition to be built in the background, its source is inflated on the
+    // library's thread and only if the library doesn't have it yet
+    void precompile_transition(const std::string& name);
     void load_textures();
+    void bind_textures();
     void set_uniforms();
 
+    // Keeps the decoder busy with the next few wallpapers
+    void prefetch();
+    bool submit_decode(std::string path);
+    // Collects finished images from the decoder, returns true if one became available
+    bool poll_decoder();
+    // Uploads the oldest prefetched image as the next texture
+    bool upload_next_texture();
+    // Whether there is an image to upload as the next texture
+    bool can_upload_next_texture() const;
+    // When the next texture should be uploaded so it is ready in time for the next
+    // transition, until then only the visible wallpaper is kept on the GPU
+    steady_clock::time_point get_upload_time() const;
+
+    // Idle mode: the final frame of a transition is read back without stalling, once it
+    // arrives it becomes the root pixmap and the window and its GPU resources are released
+    void start_readback();
+    void cancel_readback();
+    void enter_idle();
+    void leave_idle();
+    // Reads the root pixmap on another thread, leave_idle() transitions away from it
+    void start_root_read();
+
     void setup_transition();
     void start_transition();
     void load_paths();
-    std::string get_random_texture_path();
+    // Replaces the wallpapers with the images of a scan and watches its directories
+    void set_wallpapers(const WallpaperIndex::ScanResult& scan);
+    // Drops the paths of wallpapers that are gone from the path store once they are most of it
+    void compact_paths();
+    // Applies the files the watcher saw being added to or removed from the wallpaper directory
+    void apply_directory_changes(DirectoryWatcher::Changes changes);
+    // Rescans the wallpaper directories or probes the queued added files on another thread,
+    // one at a time
+    void start_probe();
+    // Applies a finished rescan or adds the images of a finished batch to the wallpapers
+    void finish_probe();
+    // The path to decode next in the configured order, empty if there is none. Wallpapers that
+    // are already queued are only picked if there are no others.
+    std::string get_next_texture_path();
+    // Paths on screen, uploaded, prefetched and decoding, in the order they are shown
+    std::vector<std::string> get_queued_paths() const;
+    // Path of the wallpaper a newly prefetched image is shown after
+    std::string get_previous_path() const;
 
     DBusConnection* m_Bus;
+    std::unique_ptr<EventLoop> m_EventLoop;
+    // Set when the idle frame has to be drawn again
+    bool m_NeedsRedraw{ true };
+    // Whether the window is unmapped and the root pixmap shows the wallpaper
+    bool m_Idle{ false };
+    unsigned int m_ReadbackBuffer{ 0 };
+    GLsync m_ReadbackFence{ nullptr };
+    // Started while idle once the next wallpaper would have been uploaded
+    std::future<std::optional<Image>> m_RootRead;
     int m_Width, m_Height;
     std::string m_Transition;
+    // Picked when the current transition is set up, it is kept while idle
+    std::string m_NextTransition;
+    // Entry of transitions_map for m_Transition, set by create_shader
+    const TransitionInfo* m_TransitionInfo{ nullptr };
 
     std::unique_ptr<Config> m_Config;
-    std::unique_ptr<Shader> m_Shader;
+    std::unique_ptr<TransitionSourceCache> m_TransitionSources;
+    std::unique_ptr<ProgramCache> m_ProgramCache;
+    std::unique_ptr<ShaderLibrary> m_Shaders;
+    // Owned by m_Shaders
+    Shader* m_Shader{ nullptr };
+    Uniform<float> m_ProgressUniform;
     std::unique_ptr<Texture> m_CurrentTexture, m_NextTexture;
 
-    std::vector<std::string> m_WallpaperPaths;
+    // Declared before the decoder so it outlives the decoder's threads
+    std::unique_ptr<UploadRing> m_UploadRing;
+    std::unique_ptr<Decoder> m_Decoder;
+    std::deque<Image> m_Prefetched;
+    // Paths submitted to the decoder and when they are expected to be done
+    std::vector<std::pair<std::string, steady_clock::time_point>> m_Decoding;
+    std::unique_ptr<CostModel> m_Costs;
+    // The last upload, timed until the GPU is done with it
+    steady_clock::time_point m_UploadStart;
+    std::pair<int, int> m_UploadSize;
+    GLsync m_UploadFence{ nullptr };
+    uint64_t m_TransitionCount{ 0 }, m_DeadlineMisses{ 0 };
+    // Path that should be shown first once it has been decoded
+    std::string m_PreferredPath;
+
+    std::unique_ptr<WallpaperIndex> m_Index;
+    WallpaperIndex::ScanOptions m_ScanOptions;
+    std::unique_ptr<DirectoryWatcher> m_Watcher;
+    // Added files waiting to be probed and the batch or rescan in flight, readable when it is
+    // done
+    std::vector<std::string> m_ProbeQueue;
+    std::future<WallpaperIndex::ScanResult> m_Probe;
+    int m_ProbeEventFd{ -1 };
+    // The watcher asked for a rescan, it runs instead of the next batch
+    bool m_RescanQueued{ false };
+    // Whether m_Probe is a rescan
+    bool m_ProbeRescan{ false };
+    // The wallpapers were loaded again while a batch was probed, its result is stale
+    bool m_ProbeStale{ false };
+    // Files removed while a batch was probed, they may be in its result
+    std::unordered_set<std::string> m_ProbeRemoved;
+    std::vector<PathStore::Id> m_WallpaperPaths;
+    // Position in m_WallpaperPaths of the next wallpaper in sequential order
+    size_t m_NextPath{ 0 };
+    // Used instead of m_WallpaperPaths when a playlist is configured
+    std::unique_ptr<Playlist> m_Playlist;
 
     steady_clock::time_point m_TransitionStart, m_TransitionEnd;
     bool m_Animating{ false };
+    // A transition was requested before the next texture was ready
+    bool m_TransitionPending{ false };
 
     Display* m_Display;
     Window m_Window;
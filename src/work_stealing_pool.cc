@@ -0,0 +1,128 @@
+#include "work_stealing_pool.hh"
+
+#include <algorithm>
+#include <thread>
+
+namespace
+{
+    // Worker the current thread is running as, if any
+    thread_local const WorkStealingPool* current_pool{ nullptr };
+    thread_local size_t current_index{ 0 };
+}
+
+WorkStealingPool::WorkStealingPool(unsigned int n_threads)
+{
+    if (n_threads == 0)
+        n_threads = std::clamp(std::thread::hardware_concurrency(), 1u, max_default_threads);
+
+    for (unsigned int i = 0; i < n_threads; ++i)
+        m_Queues.push_back(std::make_unique<Queue>());
+}
+
+void WorkStealingPool::push(Task task)
+{
+    auto index{ current_pool == this ? current_index : m_NextQueue++ % m_Queues.size() };
+    auto& queue{ *m_Queues[index] };
+
+    // Counted first so m_Queued never drops below the number of tasks in the queues
+    m_Pending.fetch_add(1, std::memory_order_relaxed);
+    m_Queued.fetch_add(1);
+
+    {
+        std::scoped_lock lock{ queue.mutex };
+        queue.tasks.push_back(std::move(task));
+    }
+
+    wake(false);
+}
+
+void WorkStealingPool::wake(bool all)
+{
+    // A worker going to sleep counts itself before it checks for tasks, so either it sees the
+    // new task or it is seen here
+    if (m_Sleeping.load() == 0)
+        return;
+
+    // Taking the lock waits for a worker between checking and sleeping to be asleep
+    {
+        std::lock_guard lock{ m_Mutex };
+    }
+
+    if (all)
+        m_CV.notify_all();
+    else
+        m_CV.notify_one();
+}
+
+void WorkStealingPool::run()
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < m_Queues.size(); ++i)
+        threads.emplace_back(&WorkStealingPool::worker, this, i);
+
+    worker(0);
+
+    for (auto& t : threads)
+        t.join();
+}
+
+void WorkStealingPool::worker(size_t index)
+{
+    current_pool  = this;
+    current_index = index;
+
+    Task task;
+
+    // Running tasks can still queue more, so only stop once nothing is pending at all
+    while (m_Pending.load(std::memory_order_acquire) > 0)
+    {
+        if (pop(index, task))
+        {
+            m_Queued.fetch_sub(1);
+            task();
+            task = nullptr;
+
+            // The last task is done, the sleeping workers can go home
+            if (m_Pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                wake(true);
+            continue;
+        }
+
+        std::unique_lock lock{ m_Mutex };
+        m_Sleeping.fetch_add(1);
+        m_CV.wait(lock, [&]() { return m_Queued.load() > 0 || m_Pending.load() == 0; });
+        m_Sleeping.fetch_sub(1);
+    }
+
+    current_pool = nullptr;
+}
+
+bool WorkStealingPool::pop(size_t index, Task& task)
+{
+    {
+        auto& own{ *m_Queues[index] };
+        std::scoped_lock lock{ own.mutex };
+
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < m_Queues.size(); ++i)
+    {
+        auto& victim{ *m_Queues[(index + i) % m_Queues.size()] };
+        std::scoped_lock lock{ victim.mutex };
+
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Runs a batch of tasks that can queue more tasks, e.g. one task per directory of a tree walk.
+// Every worker takes the newest task from its own queue and, once that is empty, steals the
+// oldest task of another worker, which in a tree walk is usually the largest subtree left.
+// Workers that find nothing to steal sleep until a task is queued.
+class WorkStealingPool
+{
+public:
+    using Task = std::function<void()>;
+
+    // Workers used by default, at most one per core
+    static constexpr unsigned int max_default_threads{ 8 };
+
+    // 0 uses the default number of workers
+    explicit WorkStealingPool(unsigned int n_threads = 0);
+
+    // From inside a task the new task goes to the calling worker's queue. Before run() tasks
+    // are spread over all queues, push must not be called from other threads during run().
+    void push(Task task);
+    // Blocks until all tasks, including the ones they queued, have finished. The calling
+    // thread works as one of the workers.
+    void run();
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void worker(size_t index);
+    bool pop(size_t index, Task& task);
+
+    // Wakes sleeping workers if there are any
+    void wake(bool all);
+
+    std::vector<std::unique_ptr<Queue>> m_Queues;
+    // Tasks that are queued or still running, and the ones that are queued
+    std::atomic<size_t> m_Pending{ 0 }, m_Queued{ 0 };
+    size_t m_NextQueue{ 0 };
+
+    std::mutex m_Mutex;
+    std::condition_variable m_CV;
+    std::atomic<unsigned int> m_Sleeping{ 0 };
+};
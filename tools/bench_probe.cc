@@ -0,0 +1,140 @@
+#include "file_prober.hh"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    void put_be32(std::string& out, uint32_t v)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back(static_cast<char>(v >> shift));
+    }
+
+    // PNG signature and IHDR, padded to size bytes. stb doesn't check the CRC.
+    std::string make_png_header(uint32_t w, uint32_t h, size_t size)
+    {
+        std::string out{ "\x89PNG\r\n\x1a\n", 8 };
+        put_be32(out, 13);
+        out += "IHDR";
+        put_be32(out, w);
+        put_be32(out, h);
+        out += std::string{ "\x08\x02\x00\x00\x00", 5 };
+        put_be32(out, 0);
+        out.resize(std::max(out.size(), size));
+        return out;
+    }
+}
+
+// Compares probing a synthetic tree one file at a time through stdio, the way the wallpaper
+// index used to, against the FileProber thread pool and io_uring paths. Pass a directory on a
+// network file system to see the difference latency makes, the page cache hides most of it
+// on a local disk.
+int main(int argc, char** argv)
+{
+    size_t n_files{ 20000 }, files_per_dir{ 100 };
+    fs::path root{ fs::temp_directory_path() / "glpaper-bench-probe" };
+
+    if (argc >= 2)
+        n_files = std::max(std::atoi(argv[1]), 1);
+    if (argc >= 3)
+        root = fs::path{ argv[2] } / "glpaper-bench-probe";
+    if (argc > 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " [files [directory]]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> paths;
+    fs::remove_all(root);
+
+    for (size_t i = 0; i < n_files; ++i)
+    {
+        auto dir{ root / std::to_string(i / files_per_dir) };
+        if (i % files_per_dir == 0)
+            fs::create_directories(dir);
+
+        paths.push_back(dir / (std::to_string(i) + ".png"));
+        std::ofstream{ paths.back(), std::ios::binary }
+            << make_png_header(1920 + i % 640, 1080 + i % 360, 4096);
+    }
+
+    std::vector<const char*> c_paths;
+    for (const auto& p : paths)
+        c_paths.push_back(p.c_str());
+
+    auto bench = [&](const std::string& name, auto&& fn) {
+        auto start{ std::chrono::steady_clock::now() };
+        uint64_t checksum{ fn() };
+        std::chrono::duration<double, std::milli> dur{ std::chrono::steady_clock::now() - start };
+        std::cout << name << ": " << dur.count() << " ms (checksum " << checksum << ")"
+                  << std::endl;
+        return checksum;
+    };
+
+    std::cout << n_files << " files in " << root << std::endl;
+
+    auto reference{ bench("sequential stdio", [&]() {
+        uint64_t sum{ 0 };
+        for (const auto& p : paths)
+        {
+            struct stat st;
+            if (stat(p.c_str(), &st) != 0)
+                continue;
+
+            FILE* f{ fopen(p.c_str(), "rbe") };
+            if (!f)
+                continue;
+
+            int w, h, comp;
+            if (stbi_info_from_file(f, &w, &h, &comp))
+                sum += static_cast<uint64_t>(w) * h + st.st_size;
+
+            fclose(f);
+        }
+        return sum;
+    }) };
+
+    bool ok{ true };
+    for (bool use_io_uring : { false, true })
+    {
+        FileProber prober{ 256, use_io_uring };
+        if (use_io_uring && !prober.has_io_uring())
+        {
+            std::cout << "io_uring: unavailable" << std::endl;
+            continue;
+        }
+
+        auto checksum{ bench(use_io_uring ? "io_uring" : "thread pool", [&]() {
+            auto stats{ prober.stat(c_paths) };
+            std::atomic<uint64_t> sum{ 0 };
+
+            prober.read_headers(c_paths, [&](size_t i, const unsigned char* data, size_t len) {
+                int w, h, comp;
+                if (stats[i].valid && len > 0 &&
+                    stbi_info_from_memory(data, len, &w, &h, &comp))
+                    sum += static_cast<uint64_t>(w) * h + stats[i].size;
+            });
+            return sum.load();
+        }) };
+
+        ok = ok && checksum == reference;
+    }
+
+    fs::remove_all(root);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
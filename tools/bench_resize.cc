@@ -0,0 +1,93 @@
+#include "resize.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compares the SIMD resize kernels against the scalar reference on a synthetic image
+int main(int argc, char** argv)
+{
+    int src_w{ 7680 }, src_h{ 4320 }, dst_w{ 1920 }, dst_h{ 1080 }, runs{ 10 };
+
+    if (argc == 6)
+    {
+        src_w = std::atoi(argv[1]);
+        src_h = std::atoi(argv[2]);
+        dst_w = std::atoi(argv[3]);
+        dst_h = std::atoi(argv[4]);
+        runs  = std::max(std::atoi(argv[5]), 1);
+    }
+    else if (argc != 1)
+    {
+        std::cerr << "Usage: " << argv[0] << " [src_w src_h dst_w dst_h runs]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto src_stride{ static_cast<size_t>(src_w) * 3 };
+    std::vector<unsigned char> src(src_stride * src_h);
+    std::mt19937 rng{ 1337 };
+    std::generate(src.begin(), src.end(), [&]() { return static_cast<unsigned char>(rng()); });
+
+    auto [w, h]{ get_cover_size(src_w, src_h, dst_w, dst_h) };
+    auto dst_stride{ get_aligned_stride(w) };
+    std::vector<unsigned char> ref(dst_stride * h), out(dst_stride * h);
+    int max_diff{ 0 };
+
+    auto bench = [&](const std::string& name, auto&& fn) {
+        fn();
+        auto start{ std::chrono::steady_clock::now() };
+        for (int i = 0; i < runs; ++i)
+            fn();
+        std::chrono::duration<double, std::milli> dur{ std::chrono::steady_clock::now() - start };
+        std::cout << name << ": " << dur.count() / runs << " ms" << std::endl;
+    };
+
+    std::cout << src_w << "x" << src_h << " -> " << w << "x" << h << ", " << runs << " runs"
+              << std::endl;
+
+    bench("scalar reference", [&]() {
+        resize_cover_scalar(src.data(), src_w, src_h, src_stride, ref.data(), w, h, dst_stride);
+    });
+
+    auto check = [&](const std::string& name) {
+        int diff{ 0 };
+        for (int y = 0; y < h; ++y)
+            for (size_t x = 0; x < static_cast<size_t>(w) * 3; ++x)
+                diff = std::max(diff, std::abs(ref[y * dst_stride + x] - out[y * dst_stride + x]));
+
+        std::cout << name << " max difference from reference: " << diff << std::endl;
+        max_diff = std::max(max_diff, diff);
+    };
+
+    // Every kernel the CPU has, not just the one resize_cover() picks
+    for (const char* kernel : get_resize_kernels())
+    {
+        std::string name{ std::string{ kernel } + " kernel" };
+        bench(name, [&]() {
+            resize_cover_kernel(
+                kernel, src.data(), src_w, src_h, src_stride, out.data(), w, h, dst_stride);
+        });
+        check(name);
+    }
+
+    // Single threaded, then on every core when there is more than one
+    std::vector<unsigned int> thread_counts{ 1 };
+    if (auto n_threads{ std::thread::hardware_concurrency() }; n_threads > 1)
+        thread_counts.push_back(n_threads);
+
+    for (unsigned int threads : thread_counts)
+    {
+        auto name{ std::string{ get_resize_kernel_name() } + " x" + std::to_string(threads) };
+        bench(name, [&]() {
+            resize_cover(src.data(), src_w, src_h, src_stride, out.data(), w, h, dst_stride, threads);
+        });
+        check(name);
+    }
+
+    return max_diff <= 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
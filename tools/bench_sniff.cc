@@ -0,0 +1,488 @@
+#include "image_sniffer.hh"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    void put_be16(std::string& out, uint32_t v)
+    {
+        out.push_back(static_cast<char>(v >> 8));
+        out.push_back(static_cast<char>(v));
+    }
+
+    void put_be32(std::string& out, uint32_t v)
+    {
+        put_be16(out, v >> 16);
+        put_be16(out, v);
+    }
+
+    void put_le16(std::string& out, uint32_t v)
+    {
+        out.push_back(static_cast<char>(v));
+        out.push_back(static_cast<char>(v >> 8));
+    }
+
+    void put_le32(std::string& out, uint32_t v)
+    {
+        put_le16(out, v);
+        put_le16(out, v >> 16);
+    }
+
+    void put_segment(std::string& out, uint8_t marker, const std::string& data)
+    {
+        out.push_back('\xff');
+        out.push_back(static_cast<char>(marker));
+        put_be16(out, data.size() + 2);
+        out += data;
+    }
+
+    // Everything up to the frame header, metadata is an APP1 segment of that size
+    std::string make_jpeg(uint32_t w, uint32_t h, size_t metadata)
+    {
+        std::string out{ "\xff\xd8", 2 };
+        put_segment(out, 0xe0, std::string{ "JFIF\0\x01\x01\0\0\x01\0\x01\0\0", 14 });
+        if (metadata > 0)
+            put_segment(out, 0xe1, "Exif" + std::string(metadata, '\0'));
+        put_segment(out, 0xdb, std::string(65, '\x01'));
+
+        std::string sof{ "\x08", 1 };
+        put_be16(sof, h);
+        put_be16(sof, w);
+        sof += std::string{ "\x03\x01\x22\x00\x02\x11\x00\x03\x11\x00", 10 };
+        put_segment(out, 0xc0, sof);
+        return out;
+    }
+
+    // stb doesn't check the CRCs
+    std::string make_png(uint32_t w, uint32_t h, uint8_t color)
+    {
+        std::string out{ "\x89PNG\r\n\x1a\n", 8 };
+        put_be32(out, 13);
+        out += "IHDR";
+        put_be32(out, w);
+        put_be32(out, h);
+        out += std::string{ "\x08", 1 };
+        out.push_back(static_cast<char>(color));
+        out += std::string(3, '\0');
+        put_be32(out, 0);
+
+        if (color == 3)
+        {
+            put_be32(out, 6);
+            out += "PLTE";
+            out += std::string(6, '\x7f');
+            put_be32(out, 0);
+        }
+
+        put_be32(out, 0);
+        out += "IDAT";
+        put_be32(out, 0);
+        return out;
+    }
+
+    std::string make_gif(uint32_t w, uint32_t h)
+    {
+        std::string out{ "GIF89a" };
+        put_le16(out, w);
+        put_le16(out, h);
+        out += std::string{ "\x00\x00\x00\x3b", 4 };
+        return out;
+    }
+
+    // A complete 24-bit image, top-down if h is negative
+    std::string make_bmp(int32_t w, int32_t h)
+    {
+        auto stride{ (w * 3 + 3) & ~3 };
+        std::string out{ "BM" };
+        put_le32(out, 54 + stride * std::abs(h));
+        put_le32(out, 0);
+        put_le32(out, 54);
+        put_le32(out, 40);
+        put_le32(out, w);
+        put_le32(out, h);
+        put_le16(out, 1);
+        put_le16(out, 24);
+        out += std::string(24, '\0');
+        out += std::string(stride * std::abs(h), '\x40');
+        return out;
+    }
+
+    std::string make_psd(uint32_t w, uint32_t h)
+    {
+        std::string out{ "8BPS" };
+        put_be16(out, 1);
+        out += std::string(6, '\0');
+        put_be16(out, 3);
+        put_be32(out, h);
+        put_be32(out, w);
+        put_be16(out, 8);
+        put_be16(out, 3);
+        out += std::string(16, '\0');
+        return out;
+    }
+
+    std::string make_pic(uint32_t w, uint32_t h)
+    {
+        std::string out{ "\x53\x80\xf6\x34" };
+        out += std::string(88, ' ');
+        put_be16(out, w);
+        put_be16(out, h);
+        out += std::string(8, '\0');
+        out += std::string{ "\x00\x08\x00\xe0", 4 };
+        out += std::string(16, '\0');
+        return out;
+    }
+
+    // A complete image with a comment in the header
+    std::string make_pnm(uint32_t w, uint32_t h)
+    {
+        auto out{ "P6\n# glpaper\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n" };
+        out += std::string(w * h * 3, '\x40');
+        return out;
+    }
+
+    // A complete image, rows narrower than 8 pixels aren't run length encoded
+    std::string make_hdr(uint32_t w, uint32_t h)
+    {
+        std::string out{ "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(h) + " +X " +
+                         std::to_string(w) + "\n" };
+        out += std::string(w * h * 4, '\x40');
+        return out;
+    }
+
+    // A complete uncompressed 24-bit image
+    std::string make_tga(uint32_t w, uint32_t h)
+    {
+        std::string out{ "\x00\x00\x02", 3 };
+        out += std::string(9, '\0');
+        put_le16(out, w);
+        put_le16(out, h);
+        out += std::string{ "\x18\x00", 2 };
+        out += std::string(w * h * 3, '\x40');
+        return out;
+    }
+
+    std::vector<std::string> make_seeds(bool small)
+    {
+        uint32_t w{ small ? 4u : 1920u }, h{ small ? 3u : 1080u };
+
+        return { make_jpeg(w, h, 0),     make_jpeg(w, h, 6000), make_png(w, h, 2),
+                 make_png(w, h, 3),      make_gif(w, h),        make_bmp(4, 3),
+                 make_bmp(4, -3),        make_psd(w, h),        make_pic(w, h),
+                 make_pnm(4, 3),         make_hdr(4, 3),        make_tga(4, 3) };
+    }
+
+    // Whether a JPEG has a quantization or Huffman table before the frame header that stbi_info
+    // rejects. The sniffer skips these segments without reading them.
+    bool has_bad_tables(const std::string& data)
+    {
+        auto byte = [&](size_t i) { return i < data.size() ? static_cast<uint8_t>(data[i]) : 0; };
+
+        for (size_t pos = 2; pos < data.size();)
+        {
+            while (pos < data.size() && byte(pos) != 0xff)
+                ++pos;
+            while (byte(pos + 1) == 0xff)
+                ++pos;
+
+            auto m{ byte(pos + 1) };
+            if (m >= 0xc0 && m <= 0xc2)
+                return false;
+
+            size_t p{ pos + 4 }, end{ pos + 2 + (byte(pos + 2) << 8 | byte(pos + 3)) };
+            if (m == 0xdb)
+            {
+                while (p < end)
+                {
+                    if (byte(p) >> 4 > 1 || (byte(p) & 15) > 3)
+                        return true;
+
+                    p += byte(p) >> 4 ? 129 : 65;
+                }
+            }
+            else if (m == 0xc4)
+            {
+                while (p < end)
+                {
+                    if (byte(p) >> 4 > 1 || (byte(p) & 15) > 3)
+                        return true;
+
+                    // The codes of each length have to fit in that many bits
+                    uint32_t code{ 0 }, n{ 0 };
+                    for (uint32_t j = 1; j <= 16; ++j)
+                    {
+                        auto count{ byte(p + j) };
+                        code += count;
+                        n += count;
+                        if (count > 0 && code - 1 >= 1u << j)
+                            return true;
+
+                        code <<= 1;
+                    }
+
+                    p += 17 + n;
+                }
+            }
+            else
+            {
+                p = end;
+            }
+
+            if (p != end)
+                return true;
+
+            pos = end;
+        }
+
+        return false;
+    }
+
+    // Whether stbi_info rejecting an image the sniffer accepts is expected. The sniffer only
+    // reads the header, stbi_info also reads on to the palette of paletted PNGs and checks the
+    // tables before the frame header of JPEGs.
+    bool reads_past_header(const std::string& data, ImageFormat format)
+    {
+        switch (format)
+        {
+        case ImageFormat::Png:
+            return data.size() > 25 && data[25] == 3;
+        case ImageFormat::Jpeg:
+            return has_bad_tables(data);
+        default:
+            return false;
+        }
+    }
+
+    // Whether both agree on images stb_image can load. Where the sniffer is stricter than
+    // stbi_info the image has to fail to load, where it is more lenient stbi_info has to have
+    // read past the header. Files ending within their header and images without pixels are
+    // rejected even though stb_image loads them.
+    struct FuzzStats
+    {
+        size_t runs{ 0 }, images{ 0 }, strict{ 0 }, lenient{ 0 }, violations{ 0 };
+    };
+
+    void check(const std::string& data, FuzzStats& stats)
+    {
+        const auto* bytes{ reinterpret_cast<const unsigned char*>(data.data()) };
+        auto sniffed{ sniff_image(bytes, data.size()) };
+        int w, h, comp;
+        bool stb{ stbi_info_from_memory(bytes, data.size(), &w, &h, &comp) != 0 };
+        bool ours{ sniffed.format != ImageFormat::Unsupported };
+
+        ++stats.runs;
+        // BMP reports the height of top-down images as negative
+        h = std::abs(h);
+
+        if (stb && ours)
+        {
+            ++stats.images;
+            if (w == sniffed.width && h == sniffed.height)
+                return;
+
+            std::cerr << "dimensions differ: stb " << w << "x" << h << ", sniffed "
+                      << sniffed.width << "x" << sniffed.height << std::endl;
+        }
+        else if (stb)
+        {
+            ++stats.strict;
+            if (sniffed.truncated || w <= 0 || h == 0)
+                return;
+
+            auto* pixels{ stbi_load_from_memory(bytes, data.size(), &w, &h, &comp, 0) };
+            if (!pixels)
+                return;
+
+            stbi_image_free(pixels);
+            std::cerr << "rejected an image stb_image loads, " << w << "x" << h << std::endl;
+        }
+        else if (ours)
+        {
+            ++stats.lenient;
+            if (reads_past_header(data, sniffed.format))
+                return;
+
+            std::cerr << "accepted an image stbi_info rejects, " << sniffed.width << "x"
+                      << sniffed.height << std::endl;
+        }
+        else
+        {
+            return;
+        }
+
+        ++stats.violations;
+        std::ofstream{ "sniff-failure.bin", std::ios::binary } << data;
+    }
+
+    int fuzz(size_t iterations, unsigned int seed)
+    {
+        auto seeds{ make_seeds(true) };
+        auto big{ make_seeds(false) };
+        seeds.insert(seeds.end(), big.begin(), big.end());
+
+        std::mt19937 rng{ seed };
+        FuzzStats stats;
+
+        for (const auto& s : seeds)
+            check(s, stats);
+
+        for (size_t i = 0; i < iterations && stats.violations == 0; ++i)
+        {
+            auto data{ seeds[rng() % seeds.size()] };
+
+            for (auto n = rng() % 4 + 1; n > 0; --n)
+            {
+                // Mostly inside the headers
+                size_t pos{ rng() % std::min<size_t>(data.size(), rng() % 2 ? 64 : data.size()) };
+
+                switch (rng() % 5)
+                {
+                case 0:
+                    data[pos] = static_cast<char>(rng());
+                    break;
+                case 1:
+                    data[pos] ^= static_cast<char>(1 << rng() % 8);
+                    break;
+                case 2:
+                    data.insert(pos, 1, static_cast<char>(rng()));
+                    break;
+                case 3:
+                    data.erase(pos, 1);
+                    break;
+                default:
+                    data.resize(pos);
+                    break;
+                }
+
+                if (data.empty())
+                    data.push_back('\0');
+            }
+
+            check(data, stats);
+        }
+
+        std::cout << stats.runs << " inputs, " << stats.images << " images, " << stats.strict
+                  << " rejected that stbi_info accepts, " << stats.lenient
+                  << " accepted that stbi_info rejects, " << stats.violations << " failures"
+                  << std::endl;
+
+        return stats.violations == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    template<typename Fn>
+    void bench(const std::string& name, size_t n_files, Fn&& fn)
+    {
+        auto start{ std::chrono::steady_clock::now() };
+        auto checksum{ fn() };
+        std::chrono::duration<double> dur{ std::chrono::steady_clock::now() - start };
+        std::cout << name << ": " << static_cast<uint64_t>(n_files / dur.count())
+                  << " files/s (checksum " << checksum << ")" << std::endl;
+    }
+}
+
+// Compares the throughput of sniff_image against stbi_info on synthetic headers of every
+// format, in memory and from files. --fuzz mutates them and checks both agree.
+int main(int argc, char** argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "--fuzz") == 0)
+    {
+        return fuzz(argc >= 3 ? std::strtoul(argv[2], nullptr, 10) : 200000,
+                    argc >= 4 ? std::strtoul(argv[3], nullptr, 10) : 1);
+    }
+
+    size_t n_files{ argc >= 2 ? std::max<size_t>(std::strtoul(argv[1], nullptr, 10), 1) : 5000 };
+    if (argc > 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [files] | --fuzz [iterations [seed]]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto seeds{ make_seeds(false) };
+    constexpr size_t rounds{ 200 };
+
+    bench("sniff_image", seeds.size() * rounds, [&]() {
+        uint64_t sum{ 0 };
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            for (const auto& s : seeds)
+            {
+                auto r{ sniff_image(reinterpret_cast<const unsigned char*>(s.data()),
+                                    std::min(s.size(), sniff_size)) };
+                sum += static_cast<uint64_t>(r.width) * r.height;
+            }
+        }
+        return sum;
+    });
+
+    bench("stbi_info_from_memory", seeds.size() * rounds, [&]() {
+        uint64_t sum{ 0 };
+        for (size_t i = 0; i < rounds; ++i)
+        {
+            for (const auto& s : seeds)
+            {
+                int w{ 0 }, h{ 0 }, comp;
+                if (stbi_info_from_memory(reinterpret_cast<const unsigned char*>(s.data()),
+                                          std::min(s.size(), sniff_size), &w, &h, &comp))
+                    sum += static_cast<uint64_t>(w) * std::abs(h);
+            }
+        }
+        return sum;
+    });
+
+    fs::path root{ fs::temp_directory_path() / "glpaper-bench-sniff" };
+    std::vector<std::string> paths;
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    for (size_t i = 0; i < n_files; ++i)
+    {
+        paths.push_back(root / std::to_string(i));
+        std::ofstream{ paths.back(), std::ios::binary } << seeds[i % seeds.size()];
+    }
+
+    bench("sniff_file", n_files, [&]() {
+        uint64_t sum{ 0 };
+        for (const auto& p : paths)
+        {
+            auto r{ sniff_file(p.c_str()) };
+            sum += static_cast<uint64_t>(r.width) * r.height;
+        }
+        return sum;
+    });
+
+    bench("stbi_info_from_file", n_files, [&]() {
+        uint64_t sum{ 0 };
+        for (const auto& p : paths)
+        {
+            FILE* f{ fopen(p.c_str(), "rbe") };
+            if (!f)
+                continue;
+
+            int w, h, comp;
+            if (stbi_info_from_file(f, &w, &h, &comp))
+                sum += static_cast<uint64_t>(w) * std::abs(h);
+
+            fclose(f);
+        }
+        return sum;
+    });
+
+    fs::remove_all(root);
+
+    return EXIT_SUCCESS;
+}
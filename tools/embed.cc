@@ -1,20 +1,296 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
 #include <cstdlib>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
 
-int main(int argc, char** argv)
+#include "transitions.hh"
+
+// Uniform annotations in the transition sources look like
+//   uniform <type> <name>; // = <default> [ratio] [inv_ratio] [bgcolor] [random(<min>, <max>)]
+// where values are either a number or a constructor such as vec2(1.0, 0.5). A constructor with
+// a single argument, or a bare number given for a vector, is broadcast to every component.
+struct Uniform
 {
-    std::ofstream out(argv[argc - 1], std::ofstream::trunc);
+    std::string name, kind;
+    size_t components{ 1 };
+    std::array<float, 4> value{}, min{}, max{};
+    std::vector<std::string> flags;
+};
+
+struct Parser
+{
+    const std::string& str;
+    size_t pos{ 0 };
+
+    void skip_space()
+    {
+        while (pos < str.size() && std::isspace(static_cast<unsigned char>(str[pos])))
+            ++pos;
+    }
+
+    bool eat(char c)
+    {
+        skip_space();
+        if (pos < str.size() && str[pos] == c)
+        {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    std::string ident()
+    {
+        skip_space();
+        auto start{ pos };
+        while (pos < str.size() &&
+               (std::isalnum(static_cast<unsigned char>(str[pos])) || str[pos] == '_'))
+            ++pos;
+        return str.substr(start, pos - start);
+    }
+
+    bool number(float& out)
+    {
+        skip_space();
+        const char* begin{ str.c_str() + pos };
+        char* end;
+        out = std::strtof(begin, &end);
+        if (end == begin)
+            return false;
+        pos += end - begin;
+        return true;
+    }
+
+    bool value(std::array<float, 4>& out, size_t components)
+    {
+        std::vector<float> values;
+        float f;
+
+        if (number(f))
+        {
+            values.push_back(f);
+        }
+        else
+        {
+            if (ident().empty() || !eat('('))
+                return false;
+            do
+            {
+                if (!number(f))
+                    return false;
+                values.push_back(f);
+            } while (eat(','));
+            if (!eat(')'))
+                return false;
+        }
+
+        if (values.size() != 1 && values.size() != components)
+            return false;
+        for (size_t i = 0; i < components; ++i)
+            out[i] = values.size() == 1 ? values[0] : values[i];
+        return true;
+    }
+};
+
+static bool parse_uniform(const std::string& line, Uniform& u)
+{
+    auto decl{ line.find_first_not_of(" \t") };
+    if (decl == std::string::npos || line.compare(decl, 8, "uniform ") != 0)
+        return false;
+
+    auto comment{ line.find("//", decl) };
+    if (comment == std::string::npos)
+        return false;
+
+    Parser p{ line, comment + 2 };
+    if (!p.eat('='))
+        return false;
+
+    std::istringstream ss{ line.substr(decl, line.find(';', decl) - decl) };
+    std::string keyword;
+    ss >> keyword >> u.kind >> u.name;
+
+    if (u.kind == "int")
+    {
+        u.kind = "Int";
+    }
+    else if (u.kind == "float")
+    {
+        u.kind = "Float";
+    }
+    else if (u.kind == "vec2" || u.kind == "vec3" || u.kind == "vec4")
+    {
+        u.components = u.kind[3] - '0';
+        u.kind       = "Vec" + u.kind.substr(3);
+    }
+    else
+    {
+        throw std::runtime_error("unsupported uniform type '" + u.kind + "'");
+    }
+
+    if (!p.value(u.value, u.components))
+        throw std::runtime_error("invalid default value for '" + u.name + "'");
+
+    for (auto flag{ p.ident() }; !flag.empty(); flag = p.ident())
+    {
+        if (flag == "random")
+        {
+            if (!p.eat('(') || !p.value(u.min, u.components) || !p.eat(',') ||
+                !p.value(u.max, u.components) || !p.eat(')'))
+                throw std::runtime_error("invalid random range for '" + u.name + "'");
+            u.flags.push_back("UniformRandom");
+        }
+        else if (flag == "ratio")
+        {
+            u.flags.push_back("UniformRatio");
+        }
+        else if (flag == "inv_ratio")
+        {
+            u.flags.push_back("UniformInvRatio");
+        }
+        else if (flag == "bgcolor")
+        {
+            u.flags.push_back("UniformBGColor");
+        }
+        else
+        {
+            throw std::runtime_error("unknown modifier '" + flag + "' for '" + u.name + "'");
+        }
+    }
+
+    return true;
+}
+
+struct Transition
+{
+    std::string name, source;
+    std::vector<Uniform> uniforms;
+    size_t offset{ 0 }, compressed_size{ 0 };
+};
+
+// Deflates every source into one raw deflate stream. Each source is followed by a full flush,
+// so it can be inflated on its own starting from its offset.
+static bool compress_sources(std::vector<Transition>& transitions, std::vector<unsigned char>& blob)
+{
+    z_stream stream{};
+    if (deflateInit2(
+            &stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    auto deflate_all{ [&](const std::string& in, int flush) {
+        stream.next_in  = reinterpret_cast<unsigned char*>(const_cast<char*>(in.data()));
+        stream.avail_in = in.size();
+        do
+        {
+            unsigned char chunk[16384];
+            stream.next_out  = chunk;
+            stream.avail_out = sizeof(chunk);
+            if (deflate(&stream, flush) == Z_STREAM_ERROR)
+                return false;
+            blob.insert(blob.end(), chunk, chunk + sizeof(chunk) - stream.avail_out);
+        } while (stream.avail_out == 0);
+        return true;
+    } };
+
+    bool ok{ true };
+    for (auto& t : transitions)
+    {
+        t.offset          = blob.size();
+        ok                = ok && deflate_all(t.source, Z_FULL_FLUSH);
+        t.compressed_size = blob.size() - t.offset;
+    }
+    ok = ok && deflate_all({}, Z_FINISH);
+    deflateEnd(&stream);
 
+    return ok;
+}
+
+// Finds a seed for every bucket so that all names land in distinct slots, placing the largest
+// buckets first while most slots are still free (hash, displace and compress)
+static bool build_perfect_hash(const std::vector<Transition>& transitions,
+                               std::vector<uint32_t>& seeds,
+                               std::vector<uint16_t>& slots)
+{
+    const auto n_slots{ transitions.size() };
+    std::vector<std::vector<size_t>> buckets(seeds.size());
+
+    for (size_t i = 0; i < transitions.size(); ++i)
+    {
+        auto hash{ fnv1a(transitions[i].name) };
+        buckets[TransitionTable::get_bucket(hash, buckets.size())].push_back(i);
+    }
+
+    std::vector<size_t> order(buckets.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    std::vector<bool> used(n_slots, false);
+    slots.assign(n_slots, 0);
+
+    for (auto b : order)
+    {
+        if (buckets[b].empty())
+            break;
+
+        bool placed{ false };
+        for (uint32_t seed = 0; seed < (1u << 24) && !placed; ++seed)
+        {
+            std::vector<size_t> taken;
+            for (auto i : buckets[b])
+            {
+                auto slot{ TransitionTable::get_slot(fnv1a(transitions[i].name), seed, n_slots) };
+                if (used[slot] || std::find(taken.begin(), taken.end(), slot) != taken.end())
+                    break;
+                taken.push_back(slot);
+            }
+
+            if (taken.size() != buckets[b].size())
+                continue;
+
+            for (size_t j = 0; j < taken.size(); ++j)
+            {
+                used[taken[j]]  = true;
+                slots[taken[j]] = buckets[b][j];
+            }
+            seeds[b] = seed;
+            placed   = true;
+        }
+
+        if (!placed)
+            return false;
+    }
+
+    return true;
+}
+
+static void write_values(std::ostream& out, const std::array<float, 4>& values)
+{
+    out << "{ ";
+    for (size_t i = 0; i < values.size(); ++i)
+        out << (i ? ", " : "") << std::setprecision(9) << values[i];
+    out << " }";
+}
+
+int main(int argc, char** argv)
+{
     if (argc < 3)
     {
         std::cerr << "Usage: " << argv[0] << " infile(s) outfile" << std::endl;
         return EXIT_FAILURE;
     }
 
-    out << "#include <map>" << std::endl;
-    out << "#include <string>" << std::endl;
-    out << "std::map<std::string_view, const unsigned char*> transitions_map = {" << std::endl;
+    std::vector<Transition> transitions;
 
     for (int i = 1; i < argc - 1; ++i)
     {
@@ -26,30 +302,121 @@ int main(int argc, char** argv)
             return EXIT_FAILURE;
         }
 
-        out << "{" << std::endl;
-        std::string name{ argv[i] };
-        name = name.substr(name.find_last_of('/') + 1);
-        out << "\"" << name.substr(0, name.find_last_of('.')) << "\", new unsigned char[]{"
-            << std::endl;
+        Transition t;
+        t.name = argv[i];
+        t.name = t.name.substr(t.name.find_last_of('/') + 1);
+        t.name = t.name.substr(0, t.name.find_last_of('.'));
 
-        size_t line_count{ 0 };
-        in.seekg(0, in.beg);
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        t.source = contents.str();
 
-        while (!in.eof())
-        {
-            char c;
-            in.get(c);
+        std::istringstream lines{ t.source };
+        std::string line;
+        size_t line_number{ 0 };
 
-            out << "0x" << std::hex << (c & 0xff) << ",";
-            if (++line_count == 10)
+        while (std::getline(lines, line))
+        {
+            ++line_number;
+            try
+            {
+                if (Uniform u; parse_uniform(line, u))
+                    t.uniforms.push_back(std::move(u));
+            }
+            catch (const std::exception& e)
             {
-                line_count = 0;
-                out << std::endl;
+                std::cerr << argv[i] << ":" << line_number << ": " << e.what() << std::endl;
+                return EXIT_FAILURE;
             }
         }
-        out << "} }," << std::endl;
+
+        transitions.push_back(std::move(t));
     }
+
+    if (transitions.size() > UINT16_MAX)
+    {
+        std::cerr << "Too many transitions" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::sort(transitions.begin(), transitions.end(), [](const auto& a, const auto& b) {
+        return a.name < b.name;
+    });
+
+    std::vector<uint32_t> seeds((transitions.size() + 1) / 2, 0);
+    std::vector<uint16_t> slots;
+
+    if (!build_perfect_hash(transitions, seeds, slots))
+    {
+        std::cerr << "Failed to build a perfect hash for the transition names" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<unsigned char> blob;
+
+    if (!compress_sources(transitions, blob))
+    {
+        std::cerr << "Failed to compress the transition sources" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream out(argv[argc - 1], std::ofstream::trunc);
+
+    out << "#include \"transitions.hh\"" << std::endl << std::endl;
+    out << "namespace" << std::endl << "{" << std::endl;
+
+    for (const auto& t : transitions)
+    {
+        if (t.uniforms.empty())
+            continue;
+
+        out << "constexpr TransitionUniform " << t.name << "_uniforms[] = {" << std::endl;
+        for (const auto& u : t.uniforms)
+        {
+            out << "    { \"" << u.name << "\", UniformKind::" << u.kind << ", ";
+            write_values(out, u.value);
+            out << ", ";
+            write_values(out, u.min);
+            out << ", ";
+            write_values(out, u.max);
+            out << ", ";
+            for (size_t j = 0; j < u.flags.size(); ++j)
+                out << (j ? " | " : "") << u.flags[j];
+            out << (u.flags.empty() ? "0" : "") << " }," << std::endl;
+        }
+        out << "};" << std::endl;
+    }
+
+    out << std::endl << "constexpr TransitionEntry entries[] = {" << std::endl;
+    for (const auto& t : transitions)
+    {
+        out << "    { \"" << t.name << "\", { " << t.offset << ", " << t.compressed_size << ", "
+            << t.source.size() << ", ";
+        if (t.uniforms.empty())
+            out << "{}";
+        else
+            out << t.name << "_uniforms";
+        out << " } }," << std::endl;
+    }
+    out << "};" << std::endl;
+
+    out << "constexpr uint32_t seeds[] = {";
+    for (size_t i = 0; i < seeds.size(); ++i)
+        out << (i % 10 ? " " : "\n    ") << seeds[i] << ",";
+    out << std::endl << "};" << std::endl;
+
+    out << "constexpr uint16_t slots[] = {";
+    for (size_t i = 0; i < slots.size(); ++i)
+        out << (i % 10 ? " " : "\n    ") << slots[i] << ",";
+    out << std::endl << "};" << std::endl;
+
+    out << "constexpr unsigned char blob[] = {";
+    for (size_t i = 0; i < blob.size(); ++i)
+        out << (i % 16 ? " " : "\n    ") << "0x" << std::hex << +blob[i] << std::dec << ",";
     out << std::endl << "};" << std::endl;
 
+    out << "}" << std::endl << std::endl;
+    out << "constexpr TransitionTable transitions_map{ entries, seeds, slots, blob };" << std::endl;
+
     return EXIT_SUCCESS;
 }
@@ -2,7 +2,7 @@
 // Author: fkuteken
 // ported by gre from https://gist.github.com/fkuteken/f63e3009c1143950dee9063c3b83fb88
 
-uniform vec4 bgcolor;
+uniform vec4 bgcolor; // = vec4(0.0, 0.0, 0.0, 1.0) bgcolor
 
 vec2 ratio2 = vec2(1.0, 1.0 / ratio);
 float s     = pow(2.0 * abs(progress - 0.5), 3.0);
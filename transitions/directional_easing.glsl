@@ -1,7 +1,7 @@
 // Author: Max Plotnikov
 // License: MIT
 
-uniform vec2 direction;
+uniform vec2 direction; // = vec2(0.0, 1.0) random(vec2(0.0, 1.0), vec2(1.0, 1.0))
 
 vec4 transition(vec2 uv)
 {
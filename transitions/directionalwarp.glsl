@@ -1,7 +1,7 @@
 // Author: pschroen
 // License: MIT
 
-uniform vec2 direction;
+uniform vec2 direction; // = vec2(-1.0, 1.0) random(-1.0, 1.0)
 
 const float smoothness = 0.5;
 const vec2 center      = vec2(0.5, 0.5);
@@ -1,7 +1,7 @@
 // Author: gre
 // License: MIT
 
-uniform vec2 direction;
+uniform vec2 direction; // = vec2(1.0, -1.0) random(-1.0, 1.0)
 
 const float smoothness = 0.5;
 
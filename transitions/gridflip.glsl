@@ -2,9 +2,9 @@
 // Author: TimDonselaar
 // ported by gre from https://gist.github.com/TimDonselaar/9bcd1c4b5934ba60087bdb55c2ea92e5
 
-uniform vec2 size;
-uniform float dividerWidth;
-uniform vec4 bgcolor;
+uniform vec2 size;          // = vec2(4.0, 4.0) ratio
+uniform float dividerWidth; // = 0.05 inv_ratio
+uniform vec4 bgcolor;       // = vec4(0.1, 0.1, 0.1, 1.0) bgcolor
 
 const float pause      = 0.1;
 const float randomness = 0.1;
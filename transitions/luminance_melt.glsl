@@ -11,7 +11,7 @@
 // or Y = (R+R+R+B+G+G+G+G)>>3
 
 // direction of movement :  0 : up, 1, down
-uniform int direction;
+uniform int direction; // = 1 random(0, 1)
 // luminance threshold
 const float l_threshold = 0.8;
 // does the movement takes effect above or below luminance threshold ?
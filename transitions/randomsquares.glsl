@@ -1,7 +1,7 @@
 // Author: gre
 // License: MIT
 
-uniform vec2 size;
+uniform vec2 size; // = vec2(10.0, 10.0) ratio
 
 const float smoothness = 0.5;
 
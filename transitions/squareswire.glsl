@@ -1,8 +1,8 @@
 // Author: gre
 // License: MIT
 
-uniform vec2 size;
-uniform vec2 direction;
+uniform vec2 size;      // = vec2(10.0, 10.0) ratio
+uniform vec2 direction; // = vec2(1.0, -0.5) random(-1.0, 1.0)
 
 const float smoothness = 1.6;
 